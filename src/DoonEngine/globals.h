@@ -48,7 +48,8 @@ typedef enum DNmessageType
 	DN_MESSAGE_CPU_MEMORY, //the message is about CPU memory usage
 	DN_MESSAGE_GPU_MEMORY, //the message is about GPU memory usage
 	DN_MESSAGE_SHADER,     //the message is about shader compilation
-	DN_MESSAGE_FILE_IO     //the message is about file I/O (just used for if opening a file fails)
+	DN_MESSAGE_FILE_IO,    //the message is about file I/O (just used for if opening a file fails)
+	DN_MESSAGE_THREADING   //the message is about worker threads
 } DNmessageType;
 
 //represents different message severities
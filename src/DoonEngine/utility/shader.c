@@ -11,22 +11,35 @@
 
 //Adds includeSource to the beginning of baseSource and returns the total string
 static char* _DN_add_include_file(char* baseSource, const char* includePath);
+//Adds defines on the line after baseSource's #version and returns the total string
+static char* _DN_add_defines(char* baseSource, const char* defines);
+//Finds the index of the newline that ends source's #version, returns false if there is none
+static bool _DN_find_version_end(const char* source, size_t* end);
 
 //Loads the all contents of a file into a buffer. Allocates but DOES NOT free memory 
 static bool _DN_load_into_buffer(const char* path, char** buffer);
 
 int DN_shader_load(GLenum type, const char* path, const char* includePath)
+{
+	return DN_shader_load_defines(type, path, includePath, NULL);
+}
+
+int DN_shader_load_defines(GLenum type, const char* path, const char* includePath, const char* defines)
 {
 	//load raw code into memory:
 	char* source = 0;
 	if(!_DN_load_into_buffer(path, &source))
 		return -1;
 
-	//add included code to original:
+	//add included code and defines to original, the defines go first so that the included code can use them too:
 	source = _DN_add_include_file(source, includePath);
 	if(source == NULL)
 		return -1;
 
+	source = _DN_add_defines(source, defines);
+	if(source == NULL)
+		return -1;
+
 	//compile:
 	GLshader shader;
 	int success;
@@ -99,7 +112,12 @@ int DN_program_load(const char* vertexPath, const char* vertexIncludePath, const
 
 int DN_compute_program_load(const char* path, const char* includePath)
 {
-	int compute = DN_shader_load(GL_COMPUTE_SHADER, path, includePath);
+	return DN_compute_program_load_defines(path, includePath, NULL);
+}
+
+int DN_compute_program_load_defines(const char* path, const char* includePath, const char* defines)
+{
+	int compute = DN_shader_load_defines(GL_COMPUTE_SHADER, path, includePath, defines);
 	if(compute < 0)
 		return -1;
 
@@ -197,29 +215,14 @@ static char* _DN_add_include_file(char* baseSource, const char* includePath)
 	size_t baseLen    = strlen(baseSource   );
 	size_t includeLen = strlen(includeSource);
 
-	char* versionStart = strstr(baseSource, "#version");
-	if(versionStart == NULL)
+	size_t i;
+	if(!_DN_find_version_end(baseSource, &i))
 	{
-		g_DN_message_callback(DN_MESSAGE_SHADER, DN_MESSAGE_ERROR, "shader source file did not contain a #version, unable to include another shader");
-
 		DN_FREE(baseSource);
 		DN_FREE(includeSource);
 		return NULL;
 	}
 
-	unsigned int i = versionStart - baseSource;
-	while(baseSource[i] != '\n')
-	{
-		i++;
-		if(i >= baseLen)
-		{
-			g_DN_message_callback(DN_MESSAGE_SHADER, DN_MESSAGE_ERROR, "end of shader source file was reached before end of #version was found");
-			DN_FREE(baseSource);
-			DN_FREE(includeSource);
-			return NULL;
-		}
-	}
-
 	char* combinedSource = DN_MALLOC(sizeof(char) * (baseLen + includeLen + 1));
 	memcpy(combinedSource, baseSource, sizeof(char) * i);
 	memcpy(&combinedSource[i], includeSource, sizeof(char) * includeLen);
@@ -230,6 +233,57 @@ static char* _DN_add_include_file(char* baseSource, const char* includePath)
 	return combinedSource;
 }
 
+static char* _DN_add_defines(char* baseSource, const char* defines)
+{
+	if(defines == NULL)
+		return baseSource;
+
+	size_t baseLen    = strlen(baseSource);
+	size_t definesLen = strlen(defines   );
+
+	size_t i;
+	if(!_DN_find_version_end(baseSource, &i))
+	{
+		DN_FREE(baseSource);
+		return NULL;
+	}
+
+	//keep the #version's newline so the defines start on their own line:
+	char* combinedSource = DN_MALLOC(sizeof(char) * (baseLen + definesLen + 1));
+	memcpy(combinedSource, baseSource, sizeof(char) * (i + 1));
+	memcpy(&combinedSource[i + 1], defines, sizeof(char) * definesLen);
+	memcpy(&combinedSource[i + 1 + definesLen], &baseSource[i + 1], sizeof(char) * (baseLen - i));
+
+	DN_FREE(baseSource);
+	return combinedSource;
+}
+
+static bool _DN_find_version_end(const char* source, size_t* end)
+{
+	size_t sourceLen = strlen(source);
+
+	char* versionStart = strstr(source, "#version");
+	if(versionStart == NULL)
+	{
+		g_DN_message_callback(DN_MESSAGE_SHADER, DN_MESSAGE_ERROR, "shader source file did not contain a #version, unable to add to it");
+		return false;
+	}
+
+	size_t i = versionStart - source;
+	while(source[i] != '\n')
+	{
+		i++;
+		if(i >= sourceLen)
+		{
+			g_DN_message_callback(DN_MESSAGE_SHADER, DN_MESSAGE_ERROR, "end of shader source file was reached before end of #version was found");
+			return false;
+		}
+	}
+
+	*end = i;
+	return true;
+}
+
 static bool _DN_load_into_buffer(const char* path, char** buffer)
 {
 	*buffer = 0;
@@ -23,6 +23,14 @@ typedef GLuint GLprogram; //a handle to a GL shader program
  * @returns the handle to the shader, or -1 on failure
  */
 int DN_shader_load(GLenum type, const char* path, const char* includePath);
+/* Loads and compiles a shader, adding preprocessor defines to the start of it
+ * @param type the type of shader to be compiled. For example, GL_VERTEX_SHADER
+ * @param path the path to the shader to be loaded
+ * @param includePath the path to the shader to be included, if an include is not needed, set to NULL
+ * @param defines the lines to add after the shader's #version, before the included code, for example "#define FOO\n". If none are needed, set to NULL
+ * @returns the handle to the shader, or -1 on failure
+ */
+int DN_shader_load_defines(GLenum type, const char* path, const char* includePath, const char* defines);
 /* Frees a shader
  * @param id the handle to the shader to free
  */
@@ -42,6 +50,13 @@ int DN_program_load(const char* vertexPath, const char* vertexIncludePath, const
  * @returns the handle to the program, or -1 on failure
  */
 int DN_compute_program_load(const char* path, const char* includePath);
+/* Generates a shader program with a compute shader, adding preprocessor defines to the start of it
+ * @param path the path to the compute shader to use
+ * @param includePath the path to the file to be included in the compute shader, or NULL if none is desired
+ * @param defines the lines to add after the shader's #version, before the included code, for example "#define FOO\n". If none are needed, set to NULL
+ * @returns the handle to the program, or -1 on failure
+ */
+int DN_compute_program_load_defines(const char* path, const char* includePath, const char* defines);
 /* Frees a shader program
  * @param id the handle to the shader program to free
  */
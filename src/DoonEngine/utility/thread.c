@@ -0,0 +1,341 @@
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../globals.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+	#include <limits.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//STRUCTS:
+
+struct DNthread
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+
+	void (*func)(void*);
+	void* arg;
+};
+
+struct DNsemaphore
+{
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint32_t count;
+#endif
+};
+
+//a single slot in a DNqueue
+typedef struct DNqueueCell
+{
+	volatile uint32_t sequence; //used to determine whether the cell is ready to be written to or read from
+	void* data;                 //the item stored in the cell
+} DNqueueCell;
+
+struct DNqueue
+{
+	DNqueueCell* cells; //the array of cells, of length mask + 1
+	uint32_t mask;      //the capacity of the queue minus 1, the capacity is always a power of 2
+
+	char padding0[64];  //keeps the positions on seperate cache lines to avoid false sharing
+	volatile uint32_t enqueuePos;
+	char padding1[64];
+	volatile uint32_t dequeuePos;
+	char padding2[64];
+};
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//THREADS:
+
+#ifdef _WIN32
+static DWORD WINAPI _DN_thread_start(LPVOID arg)
+{
+	DNthread* thread = arg;
+	thread->func(thread->arg);
+	return 0;
+}
+#else
+static void* _DN_thread_start(void* arg)
+{
+	DNthread* thread = arg;
+	thread->func(thread->arg);
+	return NULL;
+}
+#endif
+
+DNthread* DN_thread_create(void (*func)(void*), void* arg)
+{
+	DNthread* thread = DN_MALLOC(sizeof(DNthread));
+	if(!thread)
+		return NULL;
+
+	thread->func = func;
+	thread->arg = arg;
+
+#ifdef _WIN32
+	thread->handle = CreateThread(NULL, 0, _DN_thread_start, thread, 0, NULL);
+	if(thread->handle == NULL)
+#else
+	if(pthread_create(&thread->handle, NULL, _DN_thread_start, thread) != 0)
+#endif
+	{
+		DN_FREE(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void DN_thread_join(DNthread* thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+
+	DN_FREE(thread);
+}
+
+void DN_thread_yield()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+int DN_thread_hardware_concurrency()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int count = info.dwNumberOfProcessors;
+#else
+	int count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return count > 0 ? count : 1;
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//SEMAPHORES:
+
+DNsemaphore* DN_semaphore_create(uint32_t count)
+{
+	DNsemaphore* sem = DN_MALLOC(sizeof(DNsemaphore));
+	if(!sem)
+		return NULL;
+
+#ifdef _WIN32
+	sem->handle = CreateSemaphore(NULL, count, LONG_MAX, NULL);
+	if(sem->handle == NULL)
+	{
+		DN_FREE(sem);
+		return NULL;
+	}
+#else
+	if(pthread_mutex_init(&sem->mutex, NULL) != 0)
+	{
+		DN_FREE(sem);
+		return NULL;
+	}
+
+	if(pthread_cond_init(&sem->cond, NULL) != 0)
+	{
+		pthread_mutex_destroy(&sem->mutex);
+		DN_FREE(sem);
+		return NULL;
+	}
+
+	sem->count = count;
+#endif
+
+	return sem;
+}
+
+void DN_semaphore_free(DNsemaphore* sem)
+{
+#ifdef _WIN32
+	CloseHandle(sem->handle);
+#else
+	pthread_cond_destroy(&sem->cond);
+	pthread_mutex_destroy(&sem->mutex);
+#endif
+
+	DN_FREE(sem);
+}
+
+void DN_semaphore_post(DNsemaphore* sem)
+{
+#ifdef _WIN32
+	ReleaseSemaphore(sem->handle, 1, NULL);
+#else
+	pthread_mutex_lock(&sem->mutex);
+	sem->count++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+#endif
+}
+
+void DN_semaphore_wait(DNsemaphore* sem)
+{
+#ifdef _WIN32
+	WaitForSingleObject(sem->handle, INFINITE);
+#else
+	pthread_mutex_lock(&sem->mutex);
+	while(sem->count == 0)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->count--;
+	pthread_mutex_unlock(&sem->mutex);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//ATOMICS:
+
+uint32_t DN_atomic_load(volatile uint32_t* ptr)
+{
+#ifdef _MSC_VER
+	uint32_t val = *ptr; //volatile reads have acquire semantics on msvc
+	_ReadWriteBarrier();
+	return val;
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void DN_atomic_store(volatile uint32_t* ptr, uint32_t val)
+{
+#ifdef _MSC_VER
+	_ReadWriteBarrier();
+	*ptr = val; //volatile writes have release semantics on msvc
+#else
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#endif
+}
+
+bool DN_atomic_compare_exchange(volatile uint32_t* ptr, uint32_t expected, uint32_t desired)
+{
+#ifdef _MSC_VER
+	return InterlockedCompareExchange((volatile LONG*)ptr, desired, expected) == (LONG)expected;
+#else
+	return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//LOCK-FREE QUEUE:
+
+DNqueue* DN_queue_create(uint32_t capacity)
+{
+	uint32_t size = 2;
+	while(size < capacity)
+		size *= 2;
+
+	DNqueue* queue = DN_MALLOC(sizeof(DNqueue));
+	if(!queue)
+		return NULL;
+
+	queue->cells = DN_MALLOC(sizeof(DNqueueCell) * size);
+	if(!queue->cells)
+	{
+		DN_FREE(queue);
+		return NULL;
+	}
+
+	//each cell's sequence starts at its index, meaning it is ready to be written to by the producer at that position:
+	for(uint32_t i = 0; i < size; i++)
+		queue->cells[i].sequence = i;
+
+	queue->mask = size - 1;
+	queue->enqueuePos = 0;
+	queue->dequeuePos = 0;
+
+	return queue;
+}
+
+void DN_queue_free(DNqueue* queue)
+{
+	DN_FREE(queue->cells);
+	DN_FREE(queue);
+}
+
+bool DN_queue_push(DNqueue* queue, void* item)
+{
+	DNqueueCell* cell;
+	uint32_t pos = DN_atomic_load(&queue->enqueuePos);
+
+	//claim a position:
+	while(true)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		int32_t diff = (int32_t)(DN_atomic_load(&cell->sequence) - pos);
+
+		if(diff == 0) //cell is free, try to claim it
+		{
+			if(DN_atomic_compare_exchange(&queue->enqueuePos, pos, pos + 1))
+				break;
+		}
+		else if(diff < 0) //cell still holds an item from the previous lap, queue is full
+			return false;
+
+		pos = DN_atomic_load(&queue->enqueuePos);
+	}
+
+	//write the item and publish it to consumers:
+	cell->data = item;
+	DN_atomic_store(&cell->sequence, pos + 1);
+
+	return true;
+}
+
+bool DN_queue_pop(DNqueue* queue, void** item)
+{
+	DNqueueCell* cell;
+	uint32_t pos = DN_atomic_load(&queue->dequeuePos);
+
+	//claim a position:
+	while(true)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		int32_t diff = (int32_t)(DN_atomic_load(&cell->sequence) - (pos + 1));
+
+		if(diff == 0) //cell has been written to, try to claim it
+		{
+			if(DN_atomic_compare_exchange(&queue->dequeuePos, pos, pos + 1))
+				break;
+		}
+		else if(diff < 0) //cell has not been written to yet, queue is empty
+			return false;
+
+		pos = DN_atomic_load(&queue->dequeuePos);
+	}
+
+	//read the item and hand the cell back to producers for the next lap:
+	*item = cell->data;
+	DN_atomic_store(&cell->sequence, pos + queue->mask + 1);
+
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef DN_THREAD_H
+#define DN_THREAD_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "../globals.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//STRUCTS:
+
+typedef struct DNthread DNthread;       //a handle to an os thread
+typedef struct DNsemaphore DNsemaphore; //a counting semaphore, used to put threads to sleep while they have no work
+typedef struct DNqueue DNqueue;         //a bounded, lock-free, multi-producer multi-consumer queue of pointers
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//THREADS:
+
+/* Creates and starts a new thread
+ * @param func the function the thread will run
+ * @param arg the argument passed to func
+ * @returns the handle to the new thread, or NULL on failure
+ */
+DNthread* DN_thread_create(void (*func)(void*), void* arg);
+/* Waits for a thread to finish and frees its handle
+ * @param thread the thread to wait for
+ */
+void DN_thread_join(DNthread* thread);
+//Gives up the rest of the calling thread's time slice
+void DN_thread_yield();
+//@returns the number of logical processors on the system, or 1 if it could not be determined
+int DN_thread_hardware_concurrency();
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//SEMAPHORES:
+
+/* Creates a new semaphore
+ * @param count the semaphore's initial count
+ * @returns the new semaphore, or NULL on failure
+ */
+DNsemaphore* DN_semaphore_create(uint32_t count);
+//Frees a semaphore, no threads may be waiting on it
+void DN_semaphore_free(DNsemaphore* sem);
+//Increases a semaphore's count by 1, waking a waiting thread if there is one
+void DN_semaphore_post(DNsemaphore* sem);
+//Waits until a semaphore's count is greater than 0, then decreases it by 1
+void DN_semaphore_wait(DNsemaphore* sem);
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//ATOMICS:
+
+//atomically loads a value, no reads or writes after it may be reordered before it
+uint32_t DN_atomic_load(volatile uint32_t* ptr);
+//atomically stores a value, no reads or writes before it may be reordered after it
+void DN_atomic_store(volatile uint32_t* ptr, uint32_t val);
+//atomically sets *ptr to desired if it is equal to expected. @returns true if the value was set, false if not
+bool DN_atomic_compare_exchange(volatile uint32_t* ptr, uint32_t expected, uint32_t desired);
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//LOCK-FREE QUEUE:
+
+/* Creates a new queue
+ * @param capacity the maximum number of items the queue can hold, rounded up to a power of 2
+ * @returns the new queue, or NULL on failure
+ */
+DNqueue* DN_queue_create(uint32_t capacity);
+//Frees a queue, any items still in it are NOT freed
+void DN_queue_free(DNqueue* queue);
+
+/* Adds an item to the back of a queue, may be called from any thread
+ * @param queue the queue to add to
+ * @param item the item to add
+ * @returns true on success, false if the queue is full
+ */
+bool DN_queue_push(DNqueue* queue, void* item);
+/* Removes the item at the front of a queue, may be called from any thread
+ * @param queue the queue to remove from
+ * @param item populated with the removed item
+ * @returns true on success, false if the queue is empty
+ */
+bool DN_queue_pop(DNqueue* queue, void** item);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
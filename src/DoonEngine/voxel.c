@@ -1,26 +1,55 @@
 #include "voxel.h"
 #include "utility/shader.h"
+#include "utility/thread.h"
 #include "globals.h"
 #include <stdlib.h>
 #include <malloc.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <math.h>
 #include <stdio.h>
 #include <memory.h>
 #include <string.h>
+#if QM_USE_SSE
+	#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
 
 //--------------------------------------------------------------------------------------------------------------------------------//
 //GPU STRUCTS:
 
-//a single voxel, as stored on the GPU
+//a single voxel, as stored on the GPU. with DN_COMPACT_VOXELS defined it takes 12 bytes instead of 16: the normal loses precision, specular
+//light is stored in the normal's spare bits, and the lighting shader finds the voxel's position within its chunk from the chunk's bit mask
+#ifdef DN_COMPACT_VOXELS
+
+#define OCTAHEDRAL_BITS 8 //the bits used for each octahedral normal coordinate (must match voxelShared.comp)
+
+typedef struct DNvoxelGPU
+{
+	GLuint normal;       //layout: octahedral normal.x (8 bits) | octahedral normal.y (8 bits) | specular light (16 bits), the square root of each channel as RGB565. the specular light is not updated CPU-side
+	GLuint albedo;       //layout: albedo.r (8 bits) | albedo.g (8 bits) | albedo.b (8 bits) | material index (8 bits), the albedo is linear
+	GLuint diffuseLight; //used to store how much diffuse light the voxel receives, packed as RGB9E5, not updated CPU-side
+} DNvoxelGPU;
+
+#else
+
+#define OCTAHEDRAL_BITS 11 //the bits used for each octahedral normal coordinate (must match voxelShared.comp)
+
 typedef struct DNvoxelGPU
 {
-	GLuint normal;       //layout: material index (8 bits) | normal.x (8 bits) | normal.y (8 bits) | normal.z (8 bits)
-	GLuint directLight;  //used to store how much direct light the voxel receives,   not updated CPU-side
-	GLuint specLight;    //used to store how much specular light the voxel receives, not updated CPU-side
-	GLuint diffuseLight; //used to store how much diffuse light the voxel receives,  not updated CPU-side
+	GLuint normal;       //layout: octahedral normal.x (11 bits) | octahedral normal.y (11 bits) | unused (1 bit) | position within the chunk (9 bits), so the lighting shader doesn't have to search the bit mask for it
+	GLuint albedo;       //layout: albedo.r (8 bits) | albedo.g (8 bits) | albedo.b (8 bits) | material index (8 bits), the albedo is linear
+	GLuint specLight;    //used to store how much specular light the voxel receives, packed as RGB9E5, not updated CPU-side
+	GLuint diffuseLight; //used to store how much diffuse light the voxel receives,  packed as RGB9E5, not updated CPU-side
 } DNvoxelGPU;
 
+#endif
+
+#define OCTAHEDRAL_MAX ((1u << OCTAHEDRAL_BITS) - 1)                                                       //the largest octahedral normal coordinate
+#define OCTAHEDRAL_UP (((OCTAHEDRAL_MAX / 2 + 1) << (32 - OCTAHEDRAL_BITS)) | ((OCTAHEDRAL_MAX / 2 + 1) << (32 - 2 * OCTAHEDRAL_BITS))) //the encoding of a normal along +z, used for zero normals
+
 //a chunk of voxels, as stored on the GPU
 typedef struct DNchunkGPU
 {
@@ -30,7 +59,21 @@ typedef struct DNchunkGPU
 	GLuint partialCounts[3];   //how many voxels exist in this chunk before the 1/4, 1/2, and 3/4 positions, respectively. used to accelerate finding a voxel
 	GLuint bitMask[16];        //a bit mask where each bit represents whether a voxel is present or not
 
-	GLuint padding;            //for gpu alignment
+	GLuint lightingDeviation;  //the estimated noise in this chunk's lighting, stored as the bits of a float. not updated CPU-side
+
+	GLuint sunEpoch;           //the sun visibility epoch that sunLit and sunShadowed were computed in, 0 if never. not updated CPU-side
+	GLuint sunLit[16];         //a bit for every voxel whose view of the sun is clear, laid out like bitMask. not updated CPU-side
+	GLuint sunShadowed[16];    //a bit for every voxel whose view of the sun is blocked, laid out like bitMask. not updated CPU-side
+
+	GLuint numEmissive;        //the number of voxels in emissiveMask
+	GLfloat emissivePower;     //the summed luminance of every voxel in emissiveMask, used to choose which lights to sample
+	GLuint lightListed;        //whether the chunk is in the current light list. not updated CPU-side
+	GLuint lightingSamples;    //the number of diffuse samples each voxel takes in the current lighting update. not updated CPU-side
+	GLuint emissiveMask[16];   //a bit for every exposed voxel with an emissive material, laid out like bitMask
+	GLuint lightingLod;        //the level of detail band the chunk was last lit in, 0 if closer than every band. not updated CPU-side
+	GLuint lastLit;            //the lightingTimerFrame of the last lighting update that lit the chunk. not updated CPU-side
+
+	GLuint padding[1];         //for gpu alignment
 } DNchunkGPU;
 
 //a handle to a voxel chunk, as stored on the GPU
@@ -41,6 +84,39 @@ typedef struct DNchunkHandleGPU
 	GLuint voxelIndex; //the index to the voxel data for the chunk that this handle points to
 } DNchunkHandleGPU;
 
+//a chunk being prepared for upload by a worker thread
+typedef struct DNchunkJob
+{
+	DNvolume* vol;                                   //the volume the chunk belongs to, the job is pushed to its completedUploads queue once finished
+	int mapIndex;                                    //the index of the map tile the chunk is in
+	uint32_t opaqueMaterials[DN_MAX_MATERIALS / 32]; //a bit for every material, set if the material is fully opaque
+	uint32_t emissiveMaterials[DN_MAX_MATERIALS / 32]; //a bit for every material, set if the material is emissive
+	DNchunk chunk;                                   //a copy of the chunk, taken when the job was submitted
+	uint64_t neighborFaces[6];                       //the opaque voxels on the touching face of each neighboring chunk, in the order +x, -x, +y, -y, +z, -z
+
+	DNchunkGPU gpuChunk;                             //the prepared chunk, written by the worker thread
+	int numVoxels;                                   //the number of prepared voxels, written by the worker thread
+	DNvoxelGPU voxels[DN_CHUNK_LENGTH];              //the prepared voxels, written by the worker thread
+} DNchunkJob;
+
+//a re-uploaded chunk's data from before it was replaced, used by voxelLightingRemap.comp to carry its lighting over to the new layout
+typedef struct DNlightingRemapGPU
+{
+	DNchunkGPU oldChunk;                   //the chunk as it was on the GPU before being re-uploaded
+	GLuint mapIndex;                       //the map tile that was re-uploaded
+	GLuint padding[3];                     //for gpu alignment
+	DNvoxelGPU oldVoxels[DN_CHUNK_LENGTH]; //the chunk's voxels as they were on the GPU before being re-uploaded
+} DNlightingRemapGPU;
+
+//a chunk that can be evicted to make space in its voxel pool
+typedef struct DNevictionCandidate
+{
+	DNvolume* owner;    //the volume the chunk belongs to
+	int32_t mapIndex;   //the index of the map tile the chunk is in
+	uint32_t age;       //the number of syncs of the pool since the chunk was last used, as of when the candidate was found
+	uint32_t sizeIndex; //the index of the size of the chunk's node in the pool's freeVoxelNodes
+} DNevictionCandidate;
+
 //--------------------------------------------------------------------------------------------------------------------------------//
 //HELPER FUNCTIONS:
 
@@ -55,8 +131,14 @@ static bool _DN_gl_error();
 
 //generates a shader storage buffer and places the handle into dest
 static bool _DN_gen_shader_storage_buffer(GLuint* dest, size_t size);
+//frees everything a volume allocated and gives its space in the pool back, also used to clean up a volume whose creation failed partway through
+static void _DN_free_volume(DNvolume* vol);
 //clears a chunk, settting all voxels to empty
 static void _DN_clear_chunk(DNvolume* vol, int index);
+//returns the index of a map position in a map of the given size, wrapping the position around it
+static int _DN_wrap_map_index(DNivec3 pos, DNuvec3 size);
+//sends the map's origin and its position modulo the map size to a program, used to wrap map positions
+static void _DN_set_map_origin_uniforms(DNvolume* vol, GLprogram program);
 
 //file i/o and compression:
 
@@ -73,28 +155,144 @@ static void _DN_read_buffer(void* dest, char** src, size_t size);
 
 //finds an item in a palette and returns the index, returns -1 if item wasn't found
 static int _DN_find_in_palette(DNbvec3* palette, int paletteSize, DNbvec3 item);
+//loads a volume from a file into a pool, or into a new pool of its own if pool is NULL
+static DNvolume* _DN_load_volume(const char* filePath, unsigned int minChunks, DNvoxelPool* pool);
 
 //cpu/gpu streaming:
 
-//returns whether a voxel's face is visible
-static bool _DN_check_face_visible(DNvolume* vol, DNchunk chunk, DNivec3 pos);
-//converts a DNchunk to a DNchunkGPU
-static DNchunkGPU _DN_chunk_to_gpu(DNvolume* vol, DNchunk chunk, int* numVoxels, DNvoxelGPU* voxels);
-
-//determines if a chunk should have its lighting updated, if so, adds it to the request buffer
-static void _DN_request_chunk_lighting(DNvolume* vol, DNchunkHandle* cpuMap, int mapIndex, int gpuFlag, int gpuChunkIndex, bool gpuVisible, int lightingSplit);
-//streams chunk and voxel data to the gpu for a given chunk
-static void _DN_stream_to_gpu(DNvolume* vol, DNchunkHandle* cpuMap, DNchunkHandleGPU* gpuMap, DNivec3 pos, int mapIndex, int* gpuFlag, int gpuChunkIndex, bool* resizeVoxels);
+//counts the number of set bits
+static int _DN_popcount64(uint64_t x);
+//returns the index of the lowest set bit, x must not be 0
+static int _DN_count_trailing_zeros64(uint64_t x);
+//finds which materials of a volume are fully opaque and which are emissive, as one bit per material
+static void _DN_get_material_masks(DNvolume* vol, uint32_t* opaqueMaterials, uint32_t* emissiveMaterials);
+//builds a mask for every z slice of a chunk of which voxels are solid and which are solid and fully opaque
+static void _DN_build_chunk_masks(const DNchunk* chunk, const uint32_t* opaqueMaterials, uint64_t* solid, uint64_t* opaque);
+//converts a DNchunk to a DNchunkGPU, only reads from its parameters so that it can be called from worker threads
+static DNchunkGPU _DN_chunk_to_gpu(const DNchunk* chunk, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials, const uint64_t* neighborFaces, int* numVoxels, DNvoxelGPU* voxels);
+//converts the normal of a DNcompressedVoxel (3 bytes) to the octahedral encoding stored on the GPU
+static uint32_t _DN_octahedral_normal(uint32_t normal);
+#if QM_USE_SSE
+//converts 4 normals at once, with the same results as _DN_octahedral_normal()
+static __m128i _DN_octahedral_normals_sse(__m128i normal);
+#endif
+//returns a mask of the opaque voxels on the face of the chunk neighboring mapPos in the given direction (+x, -x, +y, -y, +z, -z), that touch the chunk at mapPos
+static uint64_t _DN_get_neighbor_face(DNvolume* vol, DNivec3 mapPos, int dir, const uint32_t* opaqueMaterials);
+//spreads a row of 8 bits into a column of a chunk slice mask (bit i goes to x + 8 * i)
+static uint64_t _DN_face_row_to_column(uint64_t row, int x);
+//marks the chunk at mapPos as updated, if it exists
+static void _DN_mark_chunk_updated(DNvolume* vol, DNivec3 mapPos);
+//marks the chunks that touch a voxel on the boundary of its chunk as updated, so that their culling is recalculated
+static void _DN_mark_neighbors_updated(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos);
+
+//the main loop of a worker thread, prepares chunks for upload until DN_quit() is called
+static void _DN_chunk_worker(void* arg);
+//prepares a chunk for upload and hands it back to its volume
+static void _DN_process_chunk_job(DNchunkJob* job);
+//copies a chunk and queues it to be prepared for upload, returns false if it could not be queued
+static bool _DN_submit_chunk_job(DNvolume* vol, int mapIndex, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials);
+//uploads the chunks that worker threads have finished preparing. missingNodeSize is set to the largest node that could not be found space for
+static void _DN_upload_completed_chunks(DNvolume* vol, DNchunkHandleGPU* gpuMap, uint32_t* missingNodeSize);
+//copies a loaded chunk's current gpu data to the lighting remap buffer before it is replaced, so its lighting can be carried over
+static void _DN_stage_lighting_remap(DNvolume* vol, int mapIndex);
+//carries the lighting of every chunk staged this frame over to its new layout, must be called while the map buffer is unmapped
+static void _DN_remap_lighting(DNvolume* vol);
+//makes the chunks in the shadow of the chunk at mapIndex recompute their sun visibility, called when it is uploaded or removed
+static void _DN_invalidate_shadows(DNvolume* vol, int mapIndex);
+//reads the results of DN_update_lighting()'s finished timer queries, and updates the sample rate estimate and the cursor step. if wait is true, waits for the oldest query so that its slot can be reused
+static void _DN_read_lighting_timers(DNvolume* vol, bool wait);
+//resizes the lighting request buffer to hold a work list of numVoxels voxels followed by the wavefront queues for numRays rays (none if 0), returns false on failure
+static bool _DN_resize_lighting_request_buffer(size_t numVoxels, size_t numRays);
+//binds the buffers and sends the uniforms that the lighting shader and every wavefront stage use to a program
+static void _DN_set_lighting_uniforms(DNvolume* vol, GLprogram program, uint32_t frameSeed, int maxDiffuseSamples, DNvec3* sunDir);
+//returns the number of lighting level of detail bands that a volume uses, including band 0 (closer than every band, lit with the volume's own parameters)
+static uint32_t _DN_num_lighting_lods(DNvolume* vol);
+//returns a lighting level of detail band, band 0 is made from the volume's own parameters
+static DNlightingLod _DN_get_lighting_lod(DNvolume* vol, uint32_t band);
+//waits for every chunk a volume has queued to be prepared, then discards them
+static void _DN_discard_pending_chunks(DNvolume* vol);
+
+//adds a chunk to the volume's upload queue, returns false if the queue could not be resized
+static bool _DN_queue_upload(DNvolume* vol, int mapIndex);
+//calculates how important it is to upload a chunk, based on its distance to the camera, whether it is in view, and how long it has waited
+static float _DN_upload_priority(DNvolume* vol, DNuploadRequest request, DNvec3 camDir, float cosHalfFOV);
+//compares 2 DNuploadRequests for qsort(), higher priorities come first
+static int _DN_compare_upload_requests(const void* a, const void* b);
+//sends the highest priority chunks in the upload queue to worker threads
+static void _DN_schedule_uploads(DNvolume* vol, DNchunkHandleGPU* gpuMap, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials);
+
+//adds chunks to the upload queue if they were updated or requested by the gpu
+static void _DN_stream_to_gpu(DNvolume* vol, DNchunkHandle* cpuMap, DNchunkHandleGPU* gpuMap, int mapIndex, int* gpuFlag);
 
 //unloads a chunk gpu-side
-static void _DN_unload_voxels(DNvolume* vol, int mapIndex, int chunkIndex);
+static void _DN_unload_voxels(DNvolume* vol, int mapIndex);
+//unloads every chunk a volume has in its voxel pool
+static void _DN_release_voxel_nodes(DNvolume* vol);
+//sets the flags of a map tile on the gpu, works for any volume in the pool even while another volume's map is mapped
+static void _DN_set_tile_flags(DNvolume* vol, int mapIndex, GLuint flags);
+//sets the voxel index of a map tile on the gpu, works for any volume in the pool even while another volume's map is mapped
+static void _DN_set_tile_voxel_index(DNvolume* vol, int mapIndex, GLuint voxelIndex);
+//returns the number of syncs of the pool since a node's chunk was last used, or UINT32_MAX if the node is unused
+static uint32_t _DN_voxel_node_age(DNvoxelPool* pool, DNvoxelNode node);
 //streams in a chunk (without the voxel data)
 static void _DN_stream_chunk(DNvolume* vol, int mapIndex, DNchunkGPU chunk);
 //streams in voxel data, returns true if buffer needs to be resized, false otherwise
-static bool _DN_stream_voxels(DNvolume* vol, DNivec3 pos, DNchunkHandleGPU* mapGPU, int mapIndex, int numVoxels, DNvoxelGPU* voxels);
-
-//sorts the gpu voxel buffer to combine adjacent nodes into larger ones
-static void _DN_sort_gpu_voxel_buffer(DNvolume* vol, DNchunkHandleGPU* gpuMap, int maxCopies);
+static bool _DN_stream_voxels(DNvolume* vol, int mapIndex, int numVoxels, DNvoxelGPU* voxels);
+
+//returns the index of a node size in freeVoxelNodes (0 for 16 DNvoxels, 1 for 32, ...)
+static int _DN_voxel_node_size_index(uint32_t size);
+//adds an unused node to the free list of its size
+static void _DN_push_free_voxel_node(DNvoxelPool* pool, int index);
+//removes an unused node from the free list of its size
+static void _DN_remove_free_voxel_node(DNvoxelPool* pool, int index);
+//returns whether an unused node of at least size DNvoxels exists
+static bool _DN_has_free_voxel_node(DNvoxelPool* pool, uint32_t size);
+//takes the smallest unused node of at least size DNvoxels and splits it down to size, returns its index or -1 if there is none
+static int _DN_alloc_voxel_node(DNvoxelPool* pool, uint32_t size);
+//takes an unused node off of its free list, splits it down to size and counts it towards its block's usage
+static void _DN_take_voxel_node(DNvoxelPool* pool, int index, uint32_t size);
+//marks a node as unused, merging it with its buddy for as long as the buddy is unused too
+static void _DN_free_voxel_node(DNvoxelPool* pool, int index);
+//splits a node that was taken off of its free list in half until it is the requested size, the upper halves are added to the free lists
+static void _DN_split_voxel_node(DNvoxelPool* pool, int index, uint32_t size);
+//adds unused, full-sized nodes covering the voxels in the range [start, end), both must be multiples of DN_CHUNK_LENGTH
+static void _DN_add_voxel_nodes(DNvoxelPool* pool, size_t start, size_t end);
+//recalculates voxelFragmentation from the number of unused nodes of each size
+static void _DN_update_voxel_fragmentation(DNvoxelPool* pool);
+//changes the usage of the block containing a position in the voxel buffer, moving it to the partially used list of its new usage
+static void _DN_add_voxel_block_usage(DNvoxelPool* pool, size_t pos, int32_t amount);
+//moves in-use nodes out of sparsely used blocks of the gpu voxel buffer so that the freed space can be merged, copies at most maxBytes
+static void _DN_defragment_gpu_voxel_buffer(DNvoxelPool* pool, size_t maxBytes);
+//returns the largest in-use node in a block of the voxel buffer
+static int _DN_largest_voxel_node(DNvoxelPool* pool, int block);
+//returns the smallest unused node that an in-use node fits in, in the fullest partially used block that is at least as full as the node's own, or -1 if there is none
+static int _DN_find_defrag_destination(DNvoxelPool* pool, int srcNode);
+//moves an in-use node's data into an unused node, splitting the destination down to size
+static void _DN_move_voxel_node(DNvoxelPool* pool, int srcNode, int dstNode);
+
+//creates, resizes, or frees voxel pages so that they hold num voxels in total, keeping the data in each page
+static bool _DN_resize_voxel_pages(DNvoxelPool* pool, size_t num);
+//returns the buffer of the voxel page containing a position in the voxel buffer, and sets offset to the position within that page
+static GLuint _DN_get_voxel_page(DNvoxelPool* pool, size_t pos, size_t* offset);
+//binds every voxel page to its shader storage binding (4 + page index) and sends the page size to a program
+static void _DN_bind_voxel_pages(DNvoxelPool* pool, GLprogram program);
+
+//returns the largest voxel buffer size, in DNvoxels, that keeps the pool within its vram budget
+static size_t _DN_max_voxel_cap(DNvoxelPool* pool);
+//returns the number of bytes used by a volume's map and chunk buffers
+static size_t _DN_map_vram_usage(DNvolume* vol);
+//recalculates the number of bytes used by the volume's gpu buffers and by its pool's
+static void _DN_update_vram_usage(DNvolume* vol);
+//finds every chunk in the pool that wasn't used since every volume last synced, and sorts them into evictionCandidates
+static void _DN_find_eviction_candidates(DNvoxelPool* pool);
+//compares two DNevictionCandidates by node size, then from least to most recently used, for qsort()
+static int _DN_compare_eviction_candidates(const void* a, const void* b);
+//finds the least recently used chunk with a node of at least minSize DNvoxels and removes it from the candidates, returns false if there is none
+static bool _DN_next_eviction_candidate(DNvoxelPool* pool, uint32_t minSize, DNevictionCandidate* candidate);
+//evicts the least recently used chunks of any volume in the pool until an unused node of at least nodeSize exists, only evicts chunks that weren't used since every volume last synced
+static void _DN_evict_lru_chunks(DNvoxelPool* pool, uint32_t nodeSize);
+//moves chunks out of the back of the voxel buffer if it should shrink, evicting them only if they don't fit before it and weren't used recently. returns the size the voxel buffer should be resized to
+static size_t _DN_trim_gpu_voxel_buffer(DNvoxelPool* pool);
 
 //--------------------------------------------------------------------------------------------------------------------------------//
 //GLOBAL STATE:
@@ -102,17 +300,96 @@ static void _DN_sort_gpu_voxel_buffer(DNvolume* vol, DNchunkHandleGPU* gpuMap, i
 void (*g_DN_message_callback)(DNmessageType, DNmessageSeverity, const char*);
 
 GLuint g_lightingRequestBuffer = 0;
+GLuint g_lightingRemapBuffer   = 0;
 GLuint g_materialBuffer        = 0;
-GLprogram g_lightingProgram = 0;
-GLprogram g_drawProgram     = 0;
-
-int g_maxLightingRequests = 1024;
+GLprogram g_lightingProgram        = 0;
+GLprogram g_lightingRequestProgram = 0;
+GLprogram g_lightingRemapProgram   = 0;
+GLprogram g_drawProgram            = 0;
+
+GLprogram g_wavefrontGenerateProgram = 0;
+GLprogram g_wavefrontPrepareProgram  = 0;
+GLprogram g_wavefrontTraceProgram    = 0;
+GLprogram g_wavefrontShadeProgram    = 0;
+GLprogram g_wavefrontResolveProgram  = 0;
+
+int g_maxLightingVoxels = 16384;
+int g_maxWavefrontRays = 0;            //the number of rays each wavefront queue holds, 0 until the wavefront pipeline is first used
+bool g_wavefrontRayOverflow = false;   //whether voxels were skipped because their rays didn't fit in the wavefront queues, the queues are grown afterwards
+int g_maxLightingRemaps = 32;
+int g_numLightingRemaps = 0;         //the number of chunks staged in the lighting remap buffer during the current DN_sync_gpu()
+bool g_lightingRemapOverflow = false; //whether a chunk couldn't be staged during the current DN_sync_gpu(), the buffer is grown afterwards
 
 #define DRAW_WORKGROUP_SIZE 16
 #define LIGHTING_WORKGROUP_SIZE 32
+#define LIGHTING_REQUEST_WORKGROUP_SIZE 64
+#define WAVEFRONT_WORKGROUP_SIZE 64 //must match voxelLighting.comp
+
+//the lighting request buffer starts with the indirect dispatch command for the lighting shader, the number of lights, and the number of voxels to light, each padded to a uvec4,
+//followed by the light list (a uvec2 of the chunk and its power for each chunk with emissive voxels).
+//then comes the work list, a uint of the chunk and voxel number for every voxel to light:
+#define MAX_LIGHTS 128 //must match voxelLightingRequests.comp and voxelLighting.comp
+#define LIGHTING_REQUEST_HEADER_SIZE (sizeof(GLuint) * 12 + sizeof(GLuint) * 2 * MAX_LIGHTS)
+#define LIGHTING_WORK_SIZE sizeof(GLuint)
+#define LIGHTING_STATS_OFFSET (sizeof(GLuint) * 4) //the light count, scheduling statistics, and work list size (2 uvec4s) after the dispatch command, copied out for each timed frame
+#define LIGHTING_STATS_SIZE (sizeof(GLuint) * 12)  //the statistics above followed by the wavefront statistics
+
+//when the wavefront pipeline is used, its queues follow the work list (starting at a multiple of 16 bytes, as every work list holds a multiple of 4 voxels).
+//they start with 4 uvec4 headers: the indirect dispatch commands (with the number of items in w) for both ray queues and the voxel slots, and the wavefront statistics.
+//these are followed by both ray queues, then the hit of every ray and the slot every voxel's rays add their light to:
+#define WAVEFRONT_HEADER_SIZE (sizeof(GLuint) * 16)
+#define WAVEFRONT_STATS_OFFSET (sizeof(GLuint) * 12)
+#define WAVEFRONT_RAY_SIZE (sizeof(GLuint) * 12)
+#define WAVEFRONT_HIT_SIZE (sizeof(GLuint) * 8)
+#define WAVEFRONT_SLOT_SIZE (sizeof(GLuint) * 12)
+#define WAVEFRONT_BYTES_PER_RAY (WAVEFRONT_RAY_SIZE * 2 + WAVEFRONT_HIT_SIZE + WAVEFRONT_SLOT_SIZE)
+#define WAVEFRONT_START_RAYS (1 << 16)
+#define MAX_WAVEFRONT_RAYS (1 << 19)
+
+#define LIGHTING_SAMPLE_RATE_SMOOTHING 0.25f //how quickly the estimated lighting sample rate follows new measurements
+
+//the lighting shader only counts its map and chunk data reads, for lightingCacheSavedBytes and lightingCacheSavings, if DN_LIGHTING_STATS is defined when building:
+//every shader reads voxels, so they all need to know the voxel layout:
+#ifdef DN_COMPACT_VOXELS
+#define VOXEL_DEFINES "#define COMPACT_VOXELS\n"
+#else
+#define VOXEL_DEFINES ""
+#endif
+
+#ifdef DN_LIGHTING_STATS
+#define LIGHTING_DEFINES VOXEL_DEFINES "#define CHUNK_CACHE\n#define LIGHTING_STATS\n"
+#else
+#define LIGHTING_DEFINES VOXEL_DEFINES "#define CHUNK_CACHE\n"
+#endif
+
+#define MAX_WORKER_THREADS 8
+#define CHUNK_JOB_QUEUE_SIZE 1024
+#define COMPLETED_UPLOAD_QUEUE_SIZE 256 //also the maximum number of chunks a single volume can have pending
+
+#define VOXEL_SHRINK_FRAMES 600 //the number of frames the voxel buffer must be less than a quarter full before it is halved
+#define VOXEL_NODE_MIN_SIZE 16  //the size of the smallest voxel node, nodes are stored in gpuVoxelLayout at their start position divided by this
+
+#define VOLUME_FILE_MAGIC 0x4E4F4F44 //"DOON", written after the map size by volume files that store a version, older files have the chunk cap there instead
+#define VOLUME_FILE_VERSION 1
+
+DNthread* g_workerThreads[MAX_WORKER_THREADS];
+int g_numWorkerThreads = 0;
+volatile uint32_t g_workersRunning = 0;
+DNqueue* g_chunkJobs = NULL;
+DNsemaphore* g_chunkJobSemaphore = NULL;
 
 #define GET_MATERIAL_ID(x) ((x) >> 24)
 
+#define CHUNK_MASK_MIN_X 0x0101010101010101ull //the bits in a chunk slice mask where x = 0
+#define CHUNK_MASK_MAX_X 0x8080808080808080ull //the bits in a chunk slice mask where x = DN_CHUNK_SIZE - 1
+
+uint8_t g_gammaTable[256]; //maps an sRGB color channel to a linear one, filled in by DN_init()
+
+#define MAX_VOXEL_PAGE_SHIFT 24
+#define VOXEL_PAGE_SIZE ((size_t)1 << g_voxelPageShift)
+
+uint32_t g_voxelPageShift = MAX_VOXEL_PAGE_SHIFT; //log2 of the number of voxels in a full voxel page, set by DN_init() based on GL_MAX_SHADER_STORAGE_BLOCK_SIZE
+
 //--------------------------------------------------------------------------------------------------------------------------------//
 //INITIALIZATION:
 
@@ -127,27 +404,95 @@ bool DN_init()
 	}
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g_materialBuffer);
 
-	if(!_DN_gen_shader_storage_buffer(&g_lightingRequestBuffer, sizeof(GLuint) * g_maxLightingRequests))
+	if(!_DN_gen_shader_storage_buffer(&g_lightingRequestBuffer, LIGHTING_REQUEST_HEADER_SIZE + LIGHTING_WORK_SIZE * g_maxLightingVoxels))
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate lighting request buffer");
 		return false;
 	}
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_lightingRequestBuffer);
 
-	//load shaders:
+	if(!_DN_gen_shader_storage_buffer(&g_lightingRemapBuffer, sizeof(DNlightingRemapGPU) * g_maxLightingRemaps))
+	{
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate lighting remap buffer");
+		return false;
+	}
+
+	//find the voxel page size, the largest power of 2 that fits in a single shader storage block:
+	//---------------------------------
+	GLint64 maxBlockSize;
+	glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &maxBlockSize);
+
+	g_voxelPageShift = 9; //pages must hold at least 1 full chunk so that nodes never cross pages
+	while(g_voxelPageShift < MAX_VOXEL_PAGE_SHIFT && ((GLint64)sizeof(DNvoxelGPU) << (g_voxelPageShift + 1)) <= maxBlockSize)
+		g_voxelPageShift++;
+
+	//build gamma table:
 	//---------------------------------
-	int lighting = DN_compute_program_load("shaders/voxelLighting.comp", "shaders/voxelShared.comp");
-	int draw     = DN_compute_program_load("shaders/voxelDraw.comp"    , "shaders/voxelShared.comp");
+	for(int i = 0; i < 256; i++)
+		g_gammaTable[i] = powf(i * 0.00392156862f, DN_GAMMA) * 255.0f + 0.5f;
 
-	if(lighting < 0 || draw < 0)
+	//load shaders:
+	//---------------------------------
+	int lighting         = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", LIGHTING_DEFINES);
+	int lightingRequests = DN_compute_program_load_defines("shaders/voxelLightingRequests.comp", "shaders/voxelShared.comp", VOXEL_DEFINES);
+	int lightingRemap    = DN_compute_program_load_defines("shaders/voxelLightingRemap.comp"   , "shaders/voxelShared.comp", VOXEL_DEFINES);
+	int draw             = DN_compute_program_load_defines("shaders/voxelDraw.comp"            , "shaders/voxelShared.comp", VOXEL_DEFINES);
+
+	//the wavefront stages are compiled from the lighting shader:
+	int wavefrontGenerate = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", VOXEL_DEFINES "#define WAVEFRONT\n#define WAVEFRONT_GENERATE\n");
+	int wavefrontPrepare  = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", VOXEL_DEFINES "#define WAVEFRONT\n#define WAVEFRONT_PREPARE\n" );
+	int wavefrontTrace    = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", VOXEL_DEFINES "#define WAVEFRONT\n#define WAVEFRONT_TRACE\n"   );
+	int wavefrontShade    = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", VOXEL_DEFINES "#define WAVEFRONT\n#define WAVEFRONT_SHADE\n"   );
+	int wavefrontResolve  = DN_compute_program_load_defines("shaders/voxelLighting.comp", "shaders/voxelShared.comp", VOXEL_DEFINES "#define WAVEFRONT\n#define WAVEFRONT_RESOLVE\n" );
+
+	if(lighting < 0 || lightingRequests < 0 || lightingRemap < 0 || draw < 0 ||
+	   wavefrontGenerate < 0 || wavefrontPrepare < 0 || wavefrontTrace < 0 || wavefrontShade < 0 || wavefrontResolve < 0)
 	{
 		g_DN_message_callback(DN_MESSAGE_SHADER, DN_MESSAGE_FATAL, "failed to compile 1 or more voxel shaders");
 		return false;
 	}
 
 	g_lightingProgram = lighting;
+	g_lightingRequestProgram = lightingRequests;
+	g_lightingRemapProgram = lightingRemap;
 	g_drawProgram = draw;
 
+	g_wavefrontGenerateProgram = wavefrontGenerate;
+	g_wavefrontPrepareProgram = wavefrontPrepare;
+	g_wavefrontTraceProgram = wavefrontTrace;
+	g_wavefrontShadeProgram = wavefrontShade;
+	g_wavefrontResolveProgram = wavefrontResolve;
+
+	//start worker threads:
+	//---------------------------------
+	g_chunkJobs = DN_queue_create(CHUNK_JOB_QUEUE_SIZE);
+	g_chunkJobSemaphore = DN_semaphore_create(0);
+	if(!g_chunkJobs || !g_chunkJobSemaphore)
+	{
+		g_DN_message_callback(DN_MESSAGE_THREADING, DN_MESSAGE_FATAL, "failed to create worker thread job queue");
+		return false;
+	}
+
+	//leave one core for the main thread:
+	int numThreads = fmin(fmax(DN_thread_hardware_concurrency() - 1, 1), MAX_WORKER_THREADS);
+
+	g_workersRunning = 1;
+	g_numWorkerThreads = 0;
+	for(int i = 0; i < numThreads; i++)
+	{
+		g_workerThreads[i] = DN_thread_create(_DN_chunk_worker, NULL);
+		if(!g_workerThreads[i])
+		{
+			g_DN_message_callback(DN_MESSAGE_THREADING, DN_MESSAGE_ERROR, "failed to create worker thread");
+			break;
+		}
+
+		g_numWorkerThreads++;
+	}
+
+	if(g_numWorkerThreads == 0)
+		g_DN_message_callback(DN_MESSAGE_THREADING, DN_MESSAGE_NOTE, "no worker threads available, chunks will be prepared on the main thread");
+
 	//return:
 	//---------------------------------
 	return true;
@@ -155,44 +500,105 @@ bool DN_init()
 
 void DN_quit()
 {
+	//stop worker threads:
+	DN_atomic_store(&g_workersRunning, 0);
+	for(int i = 0; i < g_numWorkerThreads; i++)
+		DN_semaphore_post(g_chunkJobSemaphore);
+	for(int i = 0; i < g_numWorkerThreads; i++)
+		DN_thread_join(g_workerThreads[i]);
+	g_numWorkerThreads = 0;
+
+	//finish any jobs that were never started, so that volumes deleted afterwards can still collect them:
+	DNchunkJob* job;
+	while(DN_queue_pop(g_chunkJobs, (void**)&job))
+		_DN_process_chunk_job(job);
+
+	DN_queue_free(g_chunkJobs);
+	DN_semaphore_free(g_chunkJobSemaphore);
+
 	DN_program_free(g_lightingProgram);
+	DN_program_free(g_lightingRequestProgram);
+	DN_program_free(g_lightingRemapProgram);
 	DN_program_free(g_drawProgram);
+	DN_program_free(g_wavefrontGenerateProgram);
+	DN_program_free(g_wavefrontPrepareProgram);
+	DN_program_free(g_wavefrontTraceProgram);
+	DN_program_free(g_wavefrontShadeProgram);
+	DN_program_free(g_wavefrontResolveProgram);
 
 	glDeleteBuffers(1, &g_materialBuffer);
 	glDeleteBuffers(1, &g_lightingRequestBuffer);
+	glDeleteBuffers(1, &g_lightingRemapBuffer);
 }
 
 DNvolume* DN_create_volume(DNuvec3 mapSize, unsigned int minChunks)
+{
+	//give the volume a pool of its own:
+	DNvoxelPool* pool = DN_create_voxel_pool(fmin(mapSize.x * mapSize.y * mapSize.z, minChunks));
+	if(!pool)
+		return NULL;
+
+	DNvolume* vol = DN_create_volume_in_pool(mapSize, minChunks, pool);
+	if(!vol)
+	{
+		DN_delete_voxel_pool(pool);
+		return NULL;
+	}
+
+	vol->ownsVoxelPool = true;
+	return vol;
+}
+
+DNvolume* DN_create_volume_in_pool(DNuvec3 mapSize, unsigned int minChunks, DNvoxelPool* pool)
 {
 	//allocate structure:
 	//---------------------------------
 	DNvolume* vol = DN_MALLOC(sizeof(DNvolume));
+	if(!vol)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for volume");
+		return NULL;
+	}
+	memset(vol, 0, sizeof(DNvolume)); //lets _DN_free_volume() tell what was allocated if creation fails
+
+	size_t numChunks;
+	numChunks = fmin(mapSize.x * mapSize.y * mapSize.z, minChunks);
+
+	//add to the pool:
+	vol->mapSize = mapSize;
+	vol->chunkCap = numChunks;
+	vol->voxelPool = pool;
+	vol->ownsVoxelPool = false;
+	pool->numVolumes++;
+	pool->chunkCap += numChunks;
+	pool->mapVramUsage += _DN_map_vram_usage(vol);
+	_DN_update_vram_usage(vol);
 
 	//generate buffers:
 	//---------------------------------
-	if(!_DN_gen_shader_storage_buffer(&vol->glMapBufferID, sizeof(DNchunkHandleGPU) * mapSize.x * mapSize.y * mapSize.x))
+	if(!_DN_gen_shader_storage_buffer(&vol->glMapBufferID, sizeof(DNchunkHandleGPU) * mapSize.x * mapSize.y * mapSize.z))
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate map buffer");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
 	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R8, GL_RED, GL_UNSIGNED_BYTE, NULL);
 
-	size_t numChunks;
-	numChunks = fmin(mapSize.x * mapSize.y * mapSize.z, minChunks);
-
-	if(!_DN_gen_shader_storage_buffer(&vol->glChunkBufferID, sizeof(DNchunkGPU) * mapSize.x * mapSize.y * mapSize.x))
+	if(!_DN_gen_shader_storage_buffer(&vol->glChunkBufferID, sizeof(DNchunkGPU) * mapSize.x * mapSize.y * mapSize.z))
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate chunk buffer");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
-	vol->voxelCap = DN_CHUNK_LENGTH * numChunks / 2;
-	if(!_DN_gen_shader_storage_buffer(&vol->glVoxelBufferID, sizeof(DNvoxelGPU) * (vol->voxelCap + DN_CHUNK_LENGTH)))
+	if(!_DN_gen_shader_storage_buffer(&vol->glLightingStatsBufferID, LIGHTING_STATS_SIZE * DN_LIGHTING_TIMER_FRAMES))
 	{
-		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate voxel buffer");
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate lighting statistics buffer");
+		_DN_free_volume(vol);
 		return NULL;
 	}
+	glGenQueries(DN_LIGHTING_TIMER_FRAMES, vol->glLightingTimerIDs);
 
 	//allocate CPU memory:
 	//---------------------------------
@@ -200,17 +606,25 @@ DNvolume* DN_create_volume(DNuvec3 mapSize, unsigned int minChunks)
 	if(!vol->map)
 	{
 		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for map");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
 	//set all map tiles to empty:
 	for(int i = 0; i < mapSize.x * mapSize.y * mapSize.z; i++)
+	{
 		vol->map[i].flag = 0;
+		vol->map[i].voxelNode = -1;
+		vol->map[i].uploadPending = false;
+		vol->map[i].uploadQueued = false;
+		vol->map[i].lastUsedClock = 0;
+	}
 
 	vol->chunks = DN_MALLOC(sizeof(DNchunk) * numChunks);
 	if(!vol->chunks)
 	{
 		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for chunks");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
@@ -222,45 +636,46 @@ DNvolume* DN_create_volume(DNuvec3 mapSize, unsigned int minChunks)
 	if(!vol->materials)
 	{
 		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for materials");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
-	vol->lightingRequests = DN_MALLOC(sizeof(GLuint) * numChunks);
-	if(!vol->lightingRequests)
+	vol->uploadQueue = DN_MALLOC(sizeof(DNuploadRequest) * numChunks);
+	if(!vol->uploadQueue)
 	{
-		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for lighting requests");
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for upload queue");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
-	vol->numVoxelNodes = vol->voxelCap / DN_CHUNK_LENGTH;
-	vol->gpuVoxelLayout = DN_MALLOC(sizeof(DNvoxelNode) * (vol->voxelCap / 16));
-	if(!vol->gpuVoxelLayout)
+	vol->completedUploads = DN_queue_create(COMPLETED_UPLOAD_QUEUE_SIZE);
+	if(!vol->completedUploads)
 	{
-		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for GPU voxel layout");
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for completed upload queue");
+		_DN_free_volume(vol);
 		return NULL;
 	}
 
-	//set up nodes (make them all max size and unloaded):
-	for(int i = 0; i < vol->numVoxelNodes; i++)
-	{
-		vol->gpuVoxelLayout[i].chunkPos.x = -1;
-		vol->gpuVoxelLayout[i].size = DN_CHUNK_LENGTH;
-		vol->gpuVoxelLayout[i].startPos = i * DN_CHUNK_LENGTH;
-	}
-
 	//set data parameters:
 	//---------------------------------
-	vol->mapSize = mapSize;
-	vol->chunkCap = numChunks;
+	vol->mapOrigin = (DNivec3){0, 0, 0};
 	vol->nextChunk = 0;
-	vol->numLightingRequests = 0;
-	vol->lightingRequestCap = numChunks;
+	vol->numPendingUploads = 0;
+	vol->numQueuedUploads = 0;
+	vol->uploadQueueCap = numChunks;
+	vol->maxUploadChunks = 64;
+	vol->maxUploadBytes = 1024 * 1024;
+	vol->numVoxelsGpu = 0;
+
+	vol->loadChunkCallback = NULL;
+	vol->unloadChunkCallback = NULL;
 
 	//set default camera and lighting parameters:
 	//---------------------------------
 	vol->camPos = (DNvec3){0.0f, 0.0f, 0.0f};
 	vol->camOrient = (DNvec3){0.0f, 0.0f, 0.0f};
 	vol->camFOV = 90.0f;
+	vol->camAspectRatio = 1.0f;
 	vol->camViewMode = 0;
 
 	vol->sunDir = (DNvec3){1.0f, 1.0f, 1.0f};
@@ -268,30 +683,153 @@ DNvolume* DN_create_volume(DNuvec3 mapSize, unsigned int minChunks)
 	vol->ambientLightStrength = (DNvec3){0.01f, 0.01f, 0.01f};
 	vol->diffuseBounceLimit = 5;
 	vol->specBounceLimit = 2;
+	vol->diffuseMode = 0;
+	vol->specularQuality = 3;
+	vol->specularLodDistance = 4.0f;
 	vol->shadowSoftness = 10.0f;
+	vol->cacheSunVisibility = false;
+	vol->wavefrontLighting = false;
+	vol->sampleEmissiveLights = false;
+
+	vol->lightingNoiseTarget = 0.0f;
+	vol->maxChunkSamples = 8;
+	vol->convergedRefreshRate = 8;
+	vol->lightingSampleBudget = 0;
+	vol->lightingTimeBudget = 0.0f;
+
+	vol->numLightingLods = 0;
+	memset(vol->lightingLods, 0, sizeof(vol->lightingLods));
 
 	vol->useCubemap = false;
 	vol->skyGradientBot = (DNvec3){0.71f, 0.85f, 0.90f};
 	vol->skyGradientTop = (DNvec3){0.00f, 0.45f, 0.74f};
 
 	vol->frameNum = 0;
+	vol->lightingSplit = 1;
 	vol->lastTime = 123.456f;
+	vol->syncCount = 0;
+
+	vol->lightingTime = 0.0f;
+	vol->lightingSamplesPerMs = 0.0f;
+	vol->lightingRaysPerMs = 0.0f;
+	vol->lightingOccupancy = 0.0f;
+	vol->lightingChunkOccupancy = 0.0f;
+	vol->lightingCacheSavedBytes = 0.0f;
+	vol->lightingCacheSavings = 0.0f;
+	vol->lightingCursor = 0;
+	vol->lightingCursorStep = 0;
+	vol->lightingTimerFrame = 0;
+	vol->lightingTimersPending = 0;
+
+	vol->sunEpoch = 1;
+	vol->sunEpochDir = vol->sunDir;
+	vol->numSunInvalidations = 0;
 
 	return vol;
 }
 
 void DN_delete_volume(DNvolume* vol)
 {
-	glDeleteBuffers(1, &vol->glMapBufferID);
-	glDeleteBuffers(1, &vol->glChunkBufferID);
-	glDeleteBuffers(1, &vol->glVoxelBufferID);
+	_DN_discard_pending_chunks(vol);
+	_DN_free_volume(vol);
+}
 
-	DN_FREE(vol->map);
-	DN_FREE(vol->chunks);
-	DN_FREE(vol->materials);
-	DN_FREE(vol->lightingRequests);
-	DN_FREE(vol->gpuVoxelLayout);
-	DN_FREE(vol);
+DNvoxelPool* DN_create_voxel_pool(unsigned int minChunks)
+{
+	DNvoxelPool* pool = DN_MALLOC(sizeof(DNvoxelPool));
+	if(!pool)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for voxel pool");
+		return NULL;
+	}
+
+	//generate buffers:
+	//---------------------------------
+	size_t voxelCap = fmin(DN_CHUNK_LENGTH * ((minChunks + 1) / 2), DN_MAX_VOXEL_PAGES * VOXEL_PAGE_SIZE); //kept a multiple of DN_CHUNK_LENGTH so that nodes stay aligned to their size
+	if(voxelCap == 0)
+		voxelCap = DN_CHUNK_LENGTH;
+
+	pool->voxelCap = 0;
+	pool->numVoxelPages = 0;
+	if(!_DN_resize_voxel_pages(pool, voxelCap))
+	{
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_FATAL, "failed to generate voxel buffer");
+		DN_FREE(pool);
+		return NULL;
+	}
+	pool->voxelCap = voxelCap;
+
+	//allocate CPU memory:
+	//---------------------------------
+	pool->gpuVoxelLayout = DN_MALLOC(sizeof(DNvoxelNode) * (pool->voxelCap / VOXEL_NODE_MIN_SIZE));
+	if(!pool->gpuVoxelLayout)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for GPU voxel layout");
+		glDeleteBuffers(pool->numVoxelPages, pool->glVoxelBufferIDs);
+		DN_FREE(pool);
+		return NULL;
+	}
+
+	pool->voxelBlocks = DN_MALLOC(sizeof(DNvoxelBlock) * (pool->voxelCap / DN_CHUNK_LENGTH));
+	if(!pool->voxelBlocks)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_FATAL, "failed to allocate memory for GPU voxel block usage");
+		glDeleteBuffers(pool->numVoxelPages, pool->glVoxelBufferIDs);
+		DN_FREE(pool->gpuVoxelLayout);
+		DN_FREE(pool);
+		return NULL;
+	}
+
+	//set up nodes (make them all max size and unloaded):
+	pool->numVoxelNodes = 0;
+	pool->numFreeVoxelsGpu = 0;
+	for(int i = 0; i < DN_NUM_VOXEL_NODE_SIZES; i++)
+	{
+		pool->freeVoxelNodes[i] = -1;
+		pool->numFreeVoxelNodes[i] = 0;
+	}
+	for(int i = 0; i < DN_NUM_VOXEL_BLOCK_USAGES; i++)
+		pool->partialVoxelBlocks[i] = -1;
+	_DN_add_voxel_nodes(pool, 0, pool->voxelCap);
+
+	pool->evictionCandidates = NULL;
+	memset(pool->evictionStart, 0, sizeof(pool->evictionStart));
+	memset(pool->evictionNext, 0, sizeof(pool->evictionNext));
+
+	//set data parameters:
+	//---------------------------------
+	pool->defragBudget = 16 * DN_CHUNK_LENGTH * sizeof(DNvoxelGPU);
+	pool->defragStalled = false;
+	pool->vramBudget = 0;
+	pool->mapVramUsage = 0;
+	pool->vramUsage = pool->voxelCap * sizeof(DNvoxelGPU);
+	pool->minVoxelCap = pool->voxelCap;
+	pool->lowUsageFrames = 0;
+
+	pool->numVolumes = 0;
+	pool->chunkCap = 0;
+	pool->clock = 0;
+	pool->evictionClock = UINT32_MAX;
+	pool->syncVolume = NULL;
+	pool->syncMap = NULL;
+
+	return pool;
+}
+
+void DN_delete_voxel_pool(DNvoxelPool* pool)
+{
+	if(pool->numVolumes > 0)
+	{
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "cannot delete a voxel pool that volumes are still stored in");
+		return;
+	}
+
+	glDeleteBuffers(pool->numVoxelPages, pool->glVoxelBufferIDs);
+	DN_FREE(pool->gpuVoxelLayout);
+	DN_FREE(pool->voxelBlocks);
+	if(pool->evictionCandidates)
+		DN_FREE(pool->evictionCandidates);
+	DN_FREE(pool);
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------//
@@ -518,6 +1056,16 @@ void _DN_decompress_chunk(char* mem, DNvolume* vol, DNchunk* chunk)
 }
 
 DNvolume* DN_load_volume(const char* filePath, unsigned int minChunks)
+{
+	return _DN_load_volume(filePath, minChunks, NULL);
+}
+
+DNvolume* DN_load_volume_in_pool(const char* filePath, unsigned int minChunks, DNvoxelPool* pool)
+{
+	return _DN_load_volume(filePath, minChunks, pool);
+}
+
+static DNvolume* _DN_load_volume(const char* filePath, unsigned int minChunks, DNvoxelPool* pool)
 {
 	//open file:
 	//---------------------------------
@@ -536,7 +1084,38 @@ DNvolume* DN_load_volume(const char* filePath, unsigned int minChunks)
 	//---------------------------------
 	DNuvec3 mapSize;
 	fread(&mapSize, sizeof(DNuvec3), 1, fptr);
-	vol = DN_create_volume(mapSize, minChunks);
+
+	//read version and map origin, older files have neither and are loaded with an origin of 0:
+	//---------------------------------
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	DNivec3 mapOrigin = {0, 0, 0};
+	fread(&magic, sizeof(uint32_t), 1, fptr);
+	if(magic == VOLUME_FILE_MAGIC)
+	{
+		fread(&version, sizeof(uint32_t), 1, fptr);
+		fread(&mapOrigin, sizeof(DNivec3), 1, fptr);
+	}
+	else
+		fseek(fptr, -(long)sizeof(uint32_t), SEEK_CUR);
+
+	if(version > VOLUME_FILE_VERSION)
+	{
+		char message[256];
+		sprintf(message, "file \"%s\" was saved with a newer version (%u)", filePath, version);
+		g_DN_message_callback(DN_MESSAGE_FILE_IO, DN_MESSAGE_ERROR, message);
+		fclose(fptr);
+		return NULL;
+	}
+
+	//the origin must be known before the chunks are read, only chunks within the map's bounds store their voxels:
+	vol = pool ? DN_create_volume_in_pool(mapSize, minChunks, pool) : DN_create_volume(mapSize, minChunks);
+	if(!vol)
+	{
+		fclose(fptr);
+		return NULL;
+	}
+	vol->mapOrigin = mapOrigin;
 
 	//read chunk cap and chunks:
 	//---------------------------------
@@ -551,13 +1130,6 @@ DNvolume* DN_load_volume(const char* filePath, unsigned int minChunks)
 		fread(&compressedSize, sizeof(uint16_t), 1, fptr);
 		fread(compressedMem, compressedSize, 1, fptr);
 		_DN_decompress_chunk(compressedMem, vol, &vol->chunks[i]);
-
-		if(DN_in_map_bounds(vol, vol->chunks[i].pos))
-		{
-			unsigned int mapIndex = DN_FLATTEN_INDEX(vol->chunks[i].pos, mapSize);
-			vol->map[mapIndex].flag = 1;
-			vol->map[mapIndex].chunkIndex = i;
-		}
 	}
 	DN_FREE(compressedMem);
 
@@ -586,6 +1158,18 @@ DNvolume* DN_load_volume(const char* filePath, unsigned int minChunks)
 	fread(&vol->skyGradientBot, sizeof(DNvec3), 1, fptr);
 	fread(&vol->skyGradientTop, sizeof(DNvec3), 1, fptr);
 
+	//add the chunks to the map:
+	//---------------------------------
+	for(int i = 0; i < chunkCap; i++)
+	{
+		if(DN_in_map_bounds(vol, vol->chunks[i].pos))
+		{
+			unsigned int mapIndex = DN_get_map_index(vol, vol->chunks[i].pos);
+			vol->map[mapIndex].flag = 1;
+			vol->map[mapIndex].chunkIndex = i;
+		}
+	}
+
 	//close file and return:
 	//---------------------------------
 	fclose(fptr);
@@ -608,6 +1192,14 @@ bool DN_save_volume(const char* filePath, DNvolume* vol)
 	//write map size and map:
 	//---------------------------------
 	fwrite(&vol->mapSize, sizeof(DNuvec3), 1, fptr);
+
+	//write version and map origin:
+	//---------------------------------
+	uint32_t magic = VOLUME_FILE_MAGIC;
+	uint32_t version = VOLUME_FILE_VERSION;
+	fwrite(&magic, sizeof(uint32_t), 1, fptr);
+	fwrite(&version, sizeof(uint32_t), 1, fptr);
+	fwrite(&vol->mapOrigin, sizeof(DNivec3), 1, fptr);
 	
 	//write chunk cap and chunks:
 	//---------------------------------
@@ -665,7 +1257,7 @@ int DN_add_chunk(DNvolume* vol, DNivec3 pos)
 	{
 		if(!DN_in_map_bounds(vol, vol->chunks[i].pos)) //if an empty chunk is found, use that one:
 		{
-			int mapIndex = DN_FLATTEN_INDEX(pos, vol->mapSize);
+			int mapIndex = DN_get_map_index(vol, pos);
 			vol->map[mapIndex].chunkIndex = i;
 			vol->map[mapIndex].flag = 1;
 
@@ -694,7 +1286,7 @@ int DN_add_chunk(DNvolume* vol, DNivec3 pos)
 		return 0;
 
 	//set chunk handle:
-	int mapIndex = DN_FLATTEN_INDEX(pos, vol->mapSize);
+	int mapIndex = DN_get_map_index(vol, pos);
 	vol->map[mapIndex].chunkIndex = i;
 	vol->map[mapIndex].flag = 1;
 
@@ -707,10 +1299,18 @@ int DN_add_chunk(DNvolume* vol, DNivec3 pos)
 
 void DN_remove_chunk(DNvolume* vol, DNivec3 pos)
 {
-	int mapIndex = DN_FLATTEN_INDEX(pos, vol->mapSize);
+	int mapIndex = DN_get_map_index(vol, pos);
 	vol->map[mapIndex].flag = 0;
 	vol->nextChunk = vol->map[mapIndex].chunkIndex;
 	_DN_clear_chunk(vol, vol->map[mapIndex].chunkIndex);
+
+	//voxels that were hidden by this chunk are now exposed:
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x + 1, pos.y, pos.z});
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x - 1, pos.y, pos.z});
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x, pos.y + 1, pos.z});
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x, pos.y - 1, pos.z});
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x, pos.y, pos.z + 1});
+	_DN_mark_chunk_updated(vol, (DNivec3){pos.x, pos.y, pos.z - 1});
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------//
@@ -718,21 +1318,34 @@ void DN_remove_chunk(DNvolume* vol, DNivec3 pos)
 
 void DN_sync_gpu(DNvolume* vol, DNmemOp op, int lightingSplit)
 {
-	//whether voxel buffer need to be resized:
-	bool resizeVoxels = false;
+	//the largest voxel node that couldn't be found space for, the voxel buffer is grown or chunks are evicted if nonzero:
+	uint32_t missingNodeSize = 0;
+
+	DNvoxelPool* pool = vol->voxelPool;
+	pool->clock++;
+	vol->syncCount++;
+	g_numLightingRemaps = 0;
+	g_lightingRemapOverflow = false;
 
 	//increase the frameNum (to determine which chunks should be updated when splitting lighting):
 	vol->frameNum++;
 	if(vol->frameNum >= lightingSplit)
 		vol->frameNum = 0;
+	vol->lightingSplit = lightingSplit;
 
 	//map the buffer:
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
 	DNchunkHandleGPU* gpuMap = (DNchunkHandleGPU*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
 	DNchunkHandle* cpuMap = vol->map;
 
-	//set lighting requests to 0:
-	vol->numLightingRequests = 0;
+	//other volumes in the pool write to this volume's tiles through the mapped buffer when they evict or move its chunks:
+	pool->syncVolume = vol;
+	pool->syncMap = gpuMap;
+
+	//find which materials are fully opaque or emissive, worker threads get a copy of this instead of reading the materials themselves:
+	uint32_t opaqueMaterials[DN_MAX_MATERIALS / 32];
+	uint32_t emissiveMaterials[DN_MAX_MATERIALS / 32];
+	_DN_get_material_masks(vol, opaqueMaterials, emissiveMaterials);
 
 	//loop through every map tile:
 	for(int z = 0; z < vol->mapSize.z; z++)
@@ -746,40 +1359,63 @@ void DN_sync_gpu(DNvolume* vol, DNmemOp op, int lightingSplit)
 		//get info for current chunk handle:
 		DNchunkHandleGPU gpuHandle = gpuMap[mapIndex];
 		int gpuFlag = gpuHandle.flags & 3;
-		int gpuChunkIndex = gpuHandle.flags >> 4;
-		bool gpuVisible = (gpuHandle.flags & 4) > 0;
 
-		//increase the "time last used" flag:
+		//increase the "time last used" flag, chunks drawn since the last sync are stamped with the pool's clock so they can be compared with other volumes' chunks:
+		if(gpuHandle.lastUsed == 0)
+			cpuMap[mapIndex].lastUsedClock = pool->clock;
 		gpuMap[mapIndex].lastUsed++;
 
-		//read data and add chunk to lighting request buffer:
-		if(op != DN_WRITE)
-			_DN_request_chunk_lighting(vol, cpuMap, mapIndex, gpuFlag, gpuChunkIndex, gpuVisible, lightingSplit);
-
-		//write data and stream to gpu:
+		//queue chunks to be uploaded:
 		if(op != DN_READ)
-			_DN_stream_to_gpu(vol, cpuMap, gpuMap, pos, mapIndex, &gpuFlag, gpuChunkIndex, &resizeVoxels);
+			_DN_stream_to_gpu(vol, cpuMap, gpuMap, mapIndex, &gpuFlag);
+	}
+
+	//send the most important chunks to worker threads and upload the ones that are ready:
+	if(op != DN_READ)
+	{
+		_DN_schedule_uploads(vol, gpuMap, opaqueMaterials, emissiveMaterials);
+		_DN_upload_completed_chunks(vol, gpuMap, &missingNodeSize);
 	}
 
-	//sort the voxel layout to allow for adjacent nodes to be merged:
-	const int MAX_SORT_COPIES = 10;
-	_DN_sort_gpu_voxel_buffer(vol, gpuMap, MAX_SORT_COPIES);
+	//defragment the voxel layout to allow for adjacent nodes to be merged:
+	_DN_defragment_gpu_voxel_buffer(pool, pool->defragBudget);
+
+	//grow the voxel buffer if it ran out of space, unless that would exceed the vram budget, in which case old chunks are evicted instead:
+	size_t newCap = pool->voxelCap;
+	if(missingNodeSize > 0)
+	{
+		//the buffer doubles until it fills a page, after that whole pages are added so that nothing needs to be copied:
+		newCap = pool->voxelCap < VOXEL_PAGE_SIZE ? pool->voxelCap * 2 : (pool->voxelCap + VOXEL_PAGE_SIZE) / VOXEL_PAGE_SIZE * VOXEL_PAGE_SIZE;
+		newCap = fmin(fmin(newCap, pool->chunkCap * DN_CHUNK_LENGTH), fmin(DN_MAX_VOXEL_PAGES * VOXEL_PAGE_SIZE, _DN_max_voxel_cap(pool)));
+	}
+
+	if(newCap <= pool->voxelCap)
+	{
+		if(missingNodeSize > 0)
+			_DN_evict_lru_chunks(pool, missingNodeSize);
+
+		newCap = _DN_trim_gpu_voxel_buffer(pool);
+	}
 
 	//unmap:
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
 	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	pool->syncVolume = NULL;
+	pool->syncMap = NULL;
 
 	//resize voxel buffer if necessary:
-	if(resizeVoxels)
+	if(newCap != pool->voxelCap)
 	{
-		size_t newCap = fmin(vol->voxelCap * 2, vol->chunkCap * DN_CHUNK_LENGTH);
-
 		char message[256];
 		sprintf(message, "automatically resizing voxel buffer to accomodate %zi GPU voxels (%zi bytes)", newCap, newCap * sizeof(DNvoxelGPU));
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_NOTE, message);
 
 		DN_set_max_voxels_gpu(vol, newCap);
 	}
+	_DN_update_vram_usage(vol);
+
+	//carry the lighting of re-uploaded chunks over, now that the map holds their final positions:
+	_DN_remap_lighting(vol);
 
 	//memory barrier to avoid any strange mem issues:
 	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
@@ -809,6 +1445,32 @@ void DN_set_view_projection_matrices(DNvolume* vol, float aspectRatio, float nea
 	*projection = DN_mat4_perspective(vol->camFOV, 1.0f / aspectRatio, nearPlane, farPlane);
 }
 
+size_t DN_pack_chunks(DNvolume* vol)
+{
+	uint32_t opaqueMaterials[DN_MAX_MATERIALS / 32];
+	uint32_t emissiveMaterials[DN_MAX_MATERIALS / 32];
+	_DN_get_material_masks(vol, opaqueMaterials, emissiveMaterials);
+
+	size_t numPacked = 0;
+	DNvoxelGPU voxels[DN_CHUNK_LENGTH];
+	for(int i = 0; i < vol->mapSize.x * vol->mapSize.y * vol->mapSize.z; i++)
+	{
+		if(vol->map[i].flag == 0)
+			continue;
+
+		const DNchunk* chunk = &vol->chunks[vol->map[i].chunkIndex];
+		uint64_t neighborFaces[6];
+		for(int j = 0; j < 6; j++)
+			neighborFaces[j] = _DN_get_neighbor_face(vol, chunk->pos, j, opaqueMaterials);
+
+		int numVoxels;
+		_DN_chunk_to_gpu(chunk, opaqueMaterials, emissiveMaterials, neighborFaces, &numVoxels, voxels);
+		numPacked += numVoxels;
+	}
+
+	return numPacked;
+}
+
 void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection, int rasterColorTexture, int rasterDepthTexture)
 {
 	glUseProgram(g_drawProgram);
@@ -816,7 +1478,7 @@ void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection
 	//bind buffers:
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vol->glMapBufferID);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vol->glChunkBufferID);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, vol->glVoxelBufferID);
+	_DN_bind_voxel_pages(vol->voxelPool, g_drawProgram);
 	glBindImageTexture(0, outputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
 
 	//send over material data:
@@ -828,6 +1490,7 @@ void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection
 	glBindTexture(GL_TEXTURE_2D, outputTexture);
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+	vol->camAspectRatio = (float)h / w;
 
 	//send rasterization pipeline textures if needed:
 	DN_program_uniform_uint(g_drawProgram, "composeRasterized", rasterColorTexture >= 0 && rasterDepthTexture >= 0);
@@ -874,6 +1537,7 @@ void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection
 	DN_program_uniform_mat4(g_drawProgram, "invCenteredViewMat", &invCenteredView);
 	DN_program_uniform_mat4(g_drawProgram, "invProjectionMat", &invProjection);
 	glUniform3uiv(glGetUniformLocation(g_drawProgram, "mapSize"), 1, (GLuint*)&vol->mapSize);
+	_DN_set_map_origin_uniforms(vol, g_drawProgram);
 
 	//dispatch and mem barrier:
 	glDispatchCompute(w / DRAW_WORKGROUP_SIZE, h / DRAW_WORKGROUP_SIZE, 1);
@@ -882,73 +1546,213 @@ void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection
 
 void DN_update_lighting(DNvolume* vol, int numDiffuseSamples, int maxDiffuseSamples, float time)
 {
-	//to ensure that each chunk gets the same seed for random sampling:
-	if(vol->frameNum == 0)
-		vol->lastTime = time;
-		
-	glUseProgram(g_lightingProgram);
+	//the lighting shader hashes the time's bits with each voxel's index, so every call gets uncorrelated samples:
+	vol->lastTime = time;
+	uint32_t frameSeed;
+	memcpy(&frameSeed, &time, sizeof(uint32_t));
 
-	//bind buffers:
+	//every chunk's cached sun visibility is out of date once the sun moves. while caching is off nothing is cached, so it stays out of date until it is turned on:
+	DNvec3 normalizedSunDir = DN_vec3_normalize(vol->sunDir);
+	if(!vol->cacheSunVisibility || vol->sunDir.x != vol->sunEpochDir.x || vol->sunDir.y != vol->sunEpochDir.y || vol->sunDir.z != vol->sunEpochDir.z)
+	{
+		vol->sunEpochDir = vol->sunDir;
+		DN_invalidate_sun_visibility(vol);
+	}
+
+	//read the timers first, they tell whether the wavefront queues overflowed:
+	uint32_t timerSlot = vol->lightingTimerFrame % DN_LIGHTING_TIMER_FRAMES;
+	_DN_read_lighting_timers(vol, true);
+
+	//resize lighting request buffer if its work list can't hold every voxel the volume can store, or if the wavefront queues are needed and too small:
+	size_t numTiles = vol->mapSize.x * vol->mapSize.y * vol->mapSize.z;
+	size_t maxVoxels = numTiles * DN_CHUNK_LENGTH;
+	if(maxVoxels > vol->voxelPool->voxelCap)
+		maxVoxels = vol->voxelPool->voxelCap;
+
+	size_t numVoxels = g_maxLightingVoxels;
+	while(numVoxels < maxVoxels)
+		numVoxels *= 2;
+
+	size_t numRays = g_maxWavefrontRays;
+	if(vol->wavefrontLighting)
+	{
+		if(numRays == 0)
+			numRays = WAVEFRONT_START_RAYS;
+		else if(g_wavefrontRayOverflow && numRays < MAX_WAVEFRONT_RAYS)
+			numRays *= 2;
+	}
+	g_wavefrontRayOverflow = false;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_lightingRequestBuffer);
+	if(numVoxels != g_maxLightingVoxels || numRays != g_maxWavefrontRays)
+		if(!_DN_resize_lighting_request_buffer(numVoxels, numRays))
+			return;
+
+	//build the lighting work list and light list on the gpu from the visibility flags written while drawing, starting from an empty dispatch and lists:
+	const GLuint emptyDispatch[12] = {0, 1, 1, 0, 0, 0, 0, UINT32_MAX, 0, 0, 0, 0};
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(emptyDispatch), emptyDispatch);
+
+	size_t wavefrontStart = LIGHTING_REQUEST_HEADER_SIZE + g_maxLightingVoxels * LIGHTING_WORK_SIZE;
+	if(vol->wavefrontLighting)
+	{
+		const GLuint emptyWavefront[16] = {0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0};
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, wavefrontStart, sizeof(emptyWavefront), emptyWavefront);
+	}
+
+	//with a time budget, every visible chunk can be lit each frame, the budget decides which ones are:
+	bool timeBudgeted = vol->lightingTimeBudget > 0.0f;
+	uint32_t lightingSplit = timeBudgeted ? 1 : vol->lightingSplit;
+	uint32_t frameNum = timeBudgeted ? 0 : vol->frameNum;
+
+	uint32_t sampleBudget = vol->lightingSampleBudget;
+	if(timeBudgeted && vol->lightingSamplesPerMs > 0.0f) //until the first measurement arrives, only lightingSampleBudget applies
+	{
+		uint32_t timeSamples = fmaxf(vol->lightingTimeBudget * vol->lightingSamplesPerMs, DN_CHUNK_LENGTH);
+		if(sampleBudget == 0 || timeSamples < sampleBudget)
+			sampleBudget = timeSamples;
+	}
+
+	vol->lightingCursor = timeBudgeted ? (vol->lightingCursor + vol->lightingCursorStep) % numTiles : 0;
+
+	glUseProgram(g_lightingRequestProgram);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vol->glChunkBufferID);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vol->glMapBufferID);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, vol->glVoxelBufferID);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_lightingRequestBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_lightingRequestBuffer);
+	glUniform3uiv(glGetUniformLocation(g_lightingRequestProgram, "mapSize"), 1, (GLuint*)&vol->mapSize);
+	DN_program_uniform_uint(g_lightingRequestProgram, "lightingSplit", lightingSplit);
+	DN_program_uniform_uint(g_lightingRequestProgram, "frameNum", frameNum);
+	DN_program_uniform_uint(g_lightingRequestProgram, "lightingCursor", vol->lightingCursor);
+
+	uint32_t refreshSplit = lightingSplit * (vol->convergedRefreshRate > 0 ? vol->convergedRefreshRate : 1);
+	DN_program_uniform_uint(g_lightingRequestProgram, "numDiffuseSamples", numDiffuseSamples);
+	DN_program_uniform_uint(g_lightingRequestProgram, "maxDiffuseSamples", maxDiffuseSamples);
+	DN_program_uniform_uint(g_lightingRequestProgram, "maxChunkSamples", vol->maxChunkSamples > 0 ? vol->maxChunkSamples : 1);
+	DN_program_uniform_float(g_lightingRequestProgram, "noiseTarget", vol->lightingNoiseTarget);
+	DN_program_uniform_uint(g_lightingRequestProgram, "sampleBudget", sampleBudget);
+	DN_program_uniform_uint(g_lightingRequestProgram, "refreshSplit", refreshSplit);
+	DN_program_uniform_uint(g_lightingRequestProgram, "refreshFrame", vol->syncCount % refreshSplit);
+	DN_program_uniform_uint(g_lightingRequestProgram, "workCapacity", g_maxLightingVoxels);
+
+	GLfloat lodDistances[DN_MAX_LIGHTING_LODS + 1] = {0};
+	GLuint lodMaxSamples[DN_MAX_LIGHTING_LODS + 1] = {0};
+	GLuint lodUpdateIntervals[DN_MAX_LIGHTING_LODS + 1] = {0};
+	uint32_t numLods = _DN_num_lighting_lods(vol);
+	for(uint32_t i = 0; i < numLods; i++)
+	{
+		DNlightingLod lod = _DN_get_lighting_lod(vol, i);
+		lodDistances[i] = lod.distance;
+		lodMaxSamples[i] = lod.maxSamples;
+		lodUpdateIntervals[i] = lod.updateInterval;
+	}
+
+	DN_program_uniform_vec3(g_lightingRequestProgram, "camPos", &vol->camPos);
+	DN_program_uniform_uint(g_lightingRequestProgram, "numLightingLods", numLods);
+	glUniform1fv(glGetUniformLocation(g_lightingRequestProgram, "lodDistances"), DN_MAX_LIGHTING_LODS + 1, lodDistances);
+	glUniform1uiv(glGetUniformLocation(g_lightingRequestProgram, "lodMaxSamples"), DN_MAX_LIGHTING_LODS + 1, lodMaxSamples);
+	glUniform1uiv(glGetUniformLocation(g_lightingRequestProgram, "lodUpdateIntervals"), DN_MAX_LIGHTING_LODS + 1, lodUpdateIntervals);
+	DN_program_uniform_uint(g_lightingRequestProgram, "lightingFrame", vol->lightingTimerFrame);
+
+	DN_program_uniform_vec3(g_lightingRequestProgram, "sunDir", &normalizedSunDir);
+	DN_program_uniform_uint(g_lightingRequestProgram, "sunEpoch", vol->sunEpoch);
+	DN_program_uniform_uint(g_lightingRequestProgram, "numSunInvalidations", vol->numSunInvalidations);
+	glUniform1uiv(glGetUniformLocation(g_lightingRequestProgram, "sunInvalidations"), DN_MAX_SUN_INVALIDATIONS, vol->sunInvalidations);
+	vol->numSunInvalidations = 0;
 
-	//resize lighting request buffer if needed:
-	if(vol->numLightingRequests > g_maxLightingRequests)
+	//time both passes, the query is read back a few frames later so the cpu doesn't wait on the gpu:
+	glBeginQuery(GL_TIME_ELAPSED, vol->glLightingTimerIDs[timerSlot]);
+
+	glDispatchCompute((numTiles + LIGHTING_REQUEST_WORKGROUP_SIZE - 1) / LIGHTING_REQUEST_WORKGROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	if(!vol->wavefrontLighting)
 	{
-		size_t newCap = g_maxLightingRequests;
-		while(newCap < vol->numLightingRequests )
-			newCap *= 2;
+		//dispatch one thread per voxel of the work list:
+		_DN_set_lighting_uniforms(vol, g_lightingProgram, frameSeed, maxDiffuseSamples, &normalizedSunDir);
 
-		char message[256];
-		sprintf(message, "automatically resizing lighting request buffer to accomodate %zi requests (%zi bytes)", newCap, newCap * sizeof(GLuint));
-		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_NOTE, message);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, g_lightingRequestBuffer);
+		glDispatchComputeIndirect(0);
+	}
+	else
+	{
+		_DN_set_lighting_uniforms(vol, g_wavefrontGenerateProgram, frameSeed, maxDiffuseSamples, &normalizedSunDir);
+		_DN_set_lighting_uniforms(vol, g_wavefrontPrepareProgram , frameSeed, maxDiffuseSamples, &normalizedSunDir);
+		_DN_set_lighting_uniforms(vol, g_wavefrontTraceProgram   , frameSeed, maxDiffuseSamples, &normalizedSunDir);
+		_DN_set_lighting_uniforms(vol, g_wavefrontShadeProgram   , frameSeed, maxDiffuseSamples, &normalizedSunDir);
+		_DN_set_lighting_uniforms(vol, g_wavefrontResolveProgram , frameSeed, maxDiffuseSamples, &normalizedSunDir);
+
+		//generate the rays of every voxel in the work list:
+		glUseProgram(g_wavefrontGenerateProgram);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, g_lightingRequestBuffer);
+		glDispatchComputeIndirect(0);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		//trace and shade every queued ray each bounce, the dispatches are sized on the gpu from the number of queued rays:
+		uint32_t maxBounces = 0;
+		for(uint32_t j = 0; j < _DN_num_lighting_lods(vol); j++)
+		{
+			DNlightingLod lod = _DN_get_lighting_lod(vol, j);
+			if(lod.diffuseBounceLimit > maxBounces)
+				maxBounces = lod.diffuseBounceLimit;
+			if(lod.specBounceLimit > maxBounces)
+				maxBounces = lod.specBounceLimit;
+		}
+		if(maxBounces == 0)
+			maxBounces = 1; //shadow and light rays are always traced once
 
-		_DN_clear_gl_errors();
-		glBufferData(GL_SHADER_STORAGE_BUFFER, newCap * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
-		if(_DN_gl_error())
+		for(uint32_t i = 0; i <= maxBounces; i++)
 		{
-			g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to resize lighting request buffer");
-			return;
+			uint32_t inQueue = i % 2;
+
+			glUseProgram(g_wavefrontPrepareProgram);
+			DN_program_uniform_uint(g_wavefrontPrepareProgram, "inQueue", inQueue);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+			if(i == maxBounces) //the last prepare only sizes the resolve pass
+				break;
+
+			glUseProgram(g_wavefrontTraceProgram);
+			DN_program_uniform_uint(g_wavefrontTraceProgram, "inQueue", inQueue);
+			glDispatchComputeIndirect(wavefrontStart + inQueue * sizeof(GLuint) * 4);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			glUseProgram(g_wavefrontShadeProgram);
+			DN_program_uniform_uint(g_wavefrontShadeProgram, "inQueue", inQueue);
+			glDispatchComputeIndirect(wavefrontStart + inQueue * sizeof(GLuint) * 4);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 		}
-		g_maxLightingRequests = newCap;
+
+		//average and store every voxel's light:
+		glUseProgram(g_wavefrontResolveProgram);
+		glDispatchComputeIndirect(wavefrontStart + sizeof(GLuint) * 8);
 	}
 
-	//send lighting requests:
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, vol->numLightingRequests  * sizeof(GLuint), vol->lightingRequests);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 
-	//send sky data:
-	DN_program_uniform_uint(g_lightingProgram, "useCubemap", vol->useCubemap);
-	DN_program_uniform_int(g_lightingProgram, "skyCubemap", 2);
-	if(vol->useCubemap)
-	{
-		glActiveTexture(GL_TEXTURE0 + 2);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, vol->glCubemapTex);
-	}
+	//keep how many samples and rays were taken and how far the budget reached, for when the timer is read:
+	glBindBuffer(GL_COPY_READ_BUFFER, g_lightingRequestBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vol->glLightingStatsBufferID);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, LIGHTING_STATS_OFFSET, timerSlot * LIGHTING_STATS_SIZE, sizeof(GLuint) * 8);
+	if(vol->wavefrontLighting)
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, wavefrontStart + WAVEFRONT_STATS_OFFSET, timerSlot * LIGHTING_STATS_SIZE + sizeof(GLuint) * 8, sizeof(GLuint) * 4);
 	else
 	{
-		DN_program_uniform_vec3(g_lightingProgram, "skyGradientBot", &vol->skyGradientBot);
-		DN_program_uniform_vec3(g_lightingProgram, "skyGradientTop", &vol->skyGradientTop);
+		const GLuint emptyStats[4] = {0, 0, 0, 0};
+		glBufferSubData(GL_COPY_WRITE_BUFFER, timerSlot * LIGHTING_STATS_SIZE + sizeof(GLuint) * 8, sizeof(emptyStats), emptyStats);
 	}
 
-	//send lighting and cam data:
-	DN_program_uniform_vec3(g_lightingProgram, "camPos", &vol->camPos);
-	DN_program_uniform_float(g_lightingProgram, "time", vol->lastTime);
-	DN_program_uniform_uint(g_lightingProgram, "numDiffuseSamples", numDiffuseSamples);
-	DN_program_uniform_uint(g_lightingProgram, "maxDiffuseSamples", maxDiffuseSamples);
-	DN_program_uniform_uint(g_lightingProgram, "diffuseBounceLimit", vol->diffuseBounceLimit);
-	DN_program_uniform_uint(g_lightingProgram, "specularBounceLimit", vol->specBounceLimit);
-	DNvec3 normalizedSunDir = DN_vec3_normalize(vol->sunDir);
-	DN_program_uniform_vec3(g_lightingProgram, "sunDir", &normalizedSunDir);
-	DN_program_uniform_vec3(g_lightingProgram, "sunStrength", &vol->sunStrength);
-	DN_program_uniform_float(g_lightingProgram, "shadowSoftness", vol->shadowSoftness);
-	DN_program_uniform_vec3(g_lightingProgram, "ambientStrength", &vol->ambientLightStrength);
-	glUniform3uiv(glGetUniformLocation(g_lightingProgram, "mapSize"), 1, (GLuint*)&vol->mapSize);
+	glEndQuery(GL_TIME_ELAPSED);
+	vol->lightingTimersPending |= 1u << timerSlot;
+	vol->lightingTimerFrame++;
+}
 
-	//dispatch and mem barrier:
-	glDispatchCompute(vol->numLightingRequests, 1, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+void DN_invalidate_sun_visibility(DNvolume* vol)
+{
+	vol->sunEpoch++;
+	if(vol->sunEpoch >= 0x80000000) //the top bit is used as a flag by the shaders, and 0 means never computed
+		vol->sunEpoch = 1;
+
+	vol->numSunInvalidations = 0; //every chunk recomputes anyways
 }
 
 //--------------------------------------------------------------------------------------------------------------------------------//
@@ -956,6 +1760,10 @@ void DN_update_lighting(DNvolume* vol, int numDiffuseSamples, int maxDiffuseSamp
 
 bool DN_set_map_size(DNvolume* vol, DNuvec3 size)
 {
+	//pending chunks and sun invalidations refer to map indices that are about to change:
+	_DN_discard_pending_chunks(vol);
+	DN_invalidate_sun_visibility(vol);
+
 	//allocate new map:
 	DNchunkHandle* newMap = DN_MALLOC(sizeof(DNchunkHandle) * size.x * size.y * size.z);
 	if(!newMap)
@@ -964,17 +1772,21 @@ bool DN_set_map_size(DNvolume* vol, DNuvec3 size)
 		return false;
 	}
 
+	//map indices are about to change, so every gpu node the volume holds is released and chunks are streamed in again:
+	_DN_release_voxel_nodes(vol);
+	vol->voxelPool->mapVramUsage -= _DN_map_vram_usage(vol);
+
 	//loop over and copy map data:
 	for(int z = 0; z < size.z; z++)
 	for(int y = 0; y < size.y; y++)
 	for(int x = 0; x < size.x; x++)
 	{
-		DNivec3 pos = {x, y, z};
+		DNivec3 pos = {vol->mapOrigin.x + x, vol->mapOrigin.y + y, vol->mapOrigin.z + z};
 
-		int oldIndex = DN_FLATTEN_INDEX(pos, vol->mapSize);
-		int newIndex = DN_FLATTEN_INDEX(pos, size);
+		int oldIndex = DN_get_map_index(vol, pos);
+		int newIndex = _DN_wrap_map_index(pos, size);
 
-		newMap[newIndex] = DN_in_map_bounds(vol, pos) ? vol->map[oldIndex] : (DNchunkHandle){0};
+		newMap[newIndex] = DN_in_map_bounds(vol, pos) ? vol->map[oldIndex] : (DNchunkHandle){0, 0, -1};
 	}
 
 	DN_FREE(vol->map);
@@ -986,29 +1798,86 @@ bool DN_set_map_size(DNvolume* vol, DNuvec3 size)
 		if(!DN_in_map_bounds(vol, vol->chunks[i].pos))
 			_DN_clear_chunk(vol, i);
 
+	for(int i = 0; i < size.x * size.y * size.z; i++)
+		vol->map[i].uploadQueued = false;
+	vol->numQueuedUploads = 0;
+	vol->voxelPool->mapVramUsage += _DN_map_vram_usage(vol);
+
 	//allocate new gpu buffer:
 	_DN_clear_gl_errors();
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DNchunkHandleGPU) * size.x * size.y * size.z, vol->map, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DNchunkHandleGPU) * size.x * size.y * size.z, NULL, GL_DYNAMIC_DRAW);
 	if(_DN_gl_error())
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate map buffer");
 		return false;
 	}
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R8, GL_RED, GL_UNSIGNED_BYTE, NULL);
 
 	//allocate new gpu chunk buffer:
 	_DN_clear_gl_errors();
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glChunkBufferID);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DNchunkGPU) * size.x * size.y * size.z, vol->map, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DNchunkGPU) * size.x * size.y * size.z, NULL, GL_DYNAMIC_DRAW);
 	if(_DN_gl_error())
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate chunk buffer");
 		return false;
 	}
 
+	_DN_update_vram_usage(vol);
 	return true;
 }
 
+void DN_set_map_origin(DNvolume* vol, DNivec3 origin)
+{
+	DNivec3 oldOrigin = vol->mapOrigin;
+	if(origin.x == oldOrigin.x && origin.y == oldOrigin.y && origin.z == oldOrigin.z)
+		return;
+
+	//remove the chunks that leave the map, their tiles are cleared on the gpu right away so that chunks entering the same tiles never show old data:
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
+	DNchunkHandleGPU* gpuMap = (DNchunkHandleGPU*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_WRITE);
+
+	for(int z = 0; z < vol->mapSize.z; z++)
+	for(int y = 0; y < vol->mapSize.y; y++)
+	for(int x = 0; x < vol->mapSize.x; x++)
+	{
+		DNivec3 pos = {oldOrigin.x + x, oldOrigin.y + y, oldOrigin.z + z};
+		DNivec3 newPos = {pos.x - origin.x, pos.y - origin.y, pos.z - origin.z};
+		if(newPos.x >= 0 && newPos.y >= 0 && newPos.z >= 0 && newPos.x < vol->mapSize.x && newPos.y < vol->mapSize.y && newPos.z < vol->mapSize.z)
+			continue;
+
+		int mapIndex = DN_get_map_index(vol, pos);
+		if(vol->map[mapIndex].flag != 0 && vol->unloadChunkCallback)
+			vol->unloadChunkCallback(vol, pos);
+		if(vol->map[mapIndex].flag != 0)
+			DN_remove_chunk(vol, pos);
+
+		_DN_unload_voxels(vol, mapIndex);
+		gpuMap[mapIndex].flags = 0;
+	}
+
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	vol->mapOrigin = origin;
+	DN_invalidate_sun_visibility(vol); //the chunks that left the map may have shadowed ones that remain
+
+	//let the application fill in the positions that entered the map:
+	if(!vol->loadChunkCallback)
+		return;
+
+	for(int z = 0; z < vol->mapSize.z; z++)
+	for(int y = 0; y < vol->mapSize.y; y++)
+	for(int x = 0; x < vol->mapSize.x; x++)
+	{
+		DNivec3 pos = {origin.x + x, origin.y + y, origin.z + z};
+		DNivec3 oldPos = {pos.x - oldOrigin.x, pos.y - oldOrigin.y, pos.z - oldOrigin.z};
+		if(oldPos.x >= 0 && oldPos.y >= 0 && oldPos.z >= 0 && oldPos.x < vol->mapSize.x && oldPos.y < vol->mapSize.y && oldPos.z < vol->mapSize.z)
+			continue;
+
+		vol->loadChunkCallback(vol, pos);
+	}
+}
+
 bool DN_set_max_chunks(DNvolume* vol, size_t num)
 {
 	//allocate space:
@@ -1024,74 +1893,105 @@ bool DN_set_max_chunks(DNvolume* vol, size_t num)
 	for(int i = vol->chunkCap; i < num; i++)
 		_DN_clear_chunk(vol, i);
 
+	vol->voxelPool->chunkCap += num - vol->chunkCap;
 	vol->chunkCap = num;
 	return true;
 }
 
 bool DN_set_max_voxels_gpu(DNvolume* vol, size_t num)
 {
-	//resize chunk layout memory:
-	DNvoxelNode* newGpuVoxelLayout = DN_REALLOC(vol->gpuVoxelLayout, sizeof(DNvoxelNode) * (num / 16));
+	DNvoxelPool* pool = vol->voxelPool;
+
+	//keep the size a multiple of DN_CHUNK_LENGTH so that nodes stay aligned:
+	num = (num + DN_CHUNK_LENGTH - 1) / DN_CHUNK_LENGTH * DN_CHUNK_LENGTH;
+	if(num == 0)
+		num = DN_CHUNK_LENGTH;
+
+	if(num > DN_MAX_VOXEL_PAGES * VOXEL_PAGE_SIZE)
+	{
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "requested voxel buffer size is larger than DN_MAX_VOXEL_PAGES pages");
+		return false;
+	}
+
+	//when shrinking, unload any chunks stored past the new end, whichever volume they belong to:
+	if(num < pool->voxelCap)
+	{
+		for(size_t i = num / VOXEL_NODE_MIN_SIZE; i < pool->voxelCap / VOXEL_NODE_MIN_SIZE; i++)
+		{
+			DNvoxelNode node = pool->gpuVoxelLayout[i];
+			if(node.mapIndex < 0)
+				continue;
+
+			_DN_set_tile_flags(node.owner, node.mapIndex, 1);
+			_DN_unload_voxels(node.owner, node.mapIndex);
+		}
+	}
+
+	//resize chunk layout memory (when shrinking, this happens once the pages have been resized):
+	DNvoxelNode* newGpuVoxelLayout = DN_REALLOC(pool->gpuVoxelLayout, sizeof(DNvoxelNode) * (fmax(num, pool->voxelCap) / VOXEL_NODE_MIN_SIZE));
 	if(!newGpuVoxelLayout)
 	{
 		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate memory for GPU voxel layput");
 		return false;
 	}
-	vol->gpuVoxelLayout = newGpuVoxelLayout;
+	pool->gpuVoxelLayout = newGpuVoxelLayout;
 
-	//create new buffer:
-	_DN_clear_gl_errors();
-	GLuint newVoxelBuffer;
-	glGenBuffers(1, &newVoxelBuffer);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, newVoxelBuffer);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, (num + DN_CHUNK_LENGTH) * sizeof(DNvoxelGPU), NULL, GL_DYNAMIC_DRAW);
-	if(_DN_gl_error())
+	DNvoxelBlock* newVoxelBlocks = DN_REALLOC(pool->voxelBlocks, sizeof(DNvoxelBlock) * (fmax(num, pool->voxelCap) / DN_CHUNK_LENGTH));
+	if(!newVoxelBlocks)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate memory for GPU voxel block usage");
+		return false;
+	}
+	pool->voxelBlocks = newVoxelBlocks;
+
+	//resize the voxel pages, only the last page is copied:
+	if(!_DN_resize_voxel_pages(pool, num))
 	{
 		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate voxel buffer");
 		return false;
 	}
-	
-	//copy into new buffer:
-	glBindBuffer(GL_COPY_READ_BUFFER, vol->glVoxelBufferID);
-	glBindBuffer(GL_COPY_WRITE_BUFFER, newVoxelBuffer);
-	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vol->voxelCap * sizeof(DNvoxelGPU));
-
-	//free old buffer:
-	glDeleteBuffers(1, &vol->glVoxelBufferID);
-	vol->glVoxelBufferID = newVoxelBuffer;
-
-	//clear voxel layout memory:
-	size_t sizeDiff = num - vol->voxelCap;
-	int numNewNodes = sizeDiff / DN_CHUNK_LENGTH;
-	
-	int startIndex = vol->numVoxelNodes;
-	size_t startSize = vol->voxelCap;
 
-	for(size_t i = 0; i < numNewNodes; i++)
+	//drop the nodes past the new end, every chunk in them was unloaded so they are all unused and full-sized:
+	if(num < pool->voxelCap)
 	{
-		vol->gpuVoxelLayout[startIndex + i].chunkPos.x = -1;
-		vol->gpuVoxelLayout[startIndex + i].size = DN_CHUNK_LENGTH;
-		vol->gpuVoxelLayout[startIndex + i].startPos = startSize + i * DN_CHUNK_LENGTH;
+		for(size_t i = num; i < pool->voxelCap; i += DN_CHUNK_LENGTH)
+		{
+			_DN_remove_free_voxel_node(pool, i / VOXEL_NODE_MIN_SIZE);
+			pool->numVoxelNodes--;
+		}
+
+		newGpuVoxelLayout = DN_REALLOC(pool->gpuVoxelLayout, sizeof(DNvoxelNode) * (num / VOXEL_NODE_MIN_SIZE));
+		if(newGpuVoxelLayout)
+			pool->gpuVoxelLayout = newGpuVoxelLayout;
+
+		newVoxelBlocks = DN_REALLOC(pool->voxelBlocks, sizeof(DNvoxelBlock) * (num / DN_CHUNK_LENGTH));
+		if(newVoxelBlocks)
+			pool->voxelBlocks = newVoxelBlocks;
 	}
 
-	//set voxel cap nad num nodes:
-	vol->numVoxelNodes += numNewNodes;
-	vol->voxelCap = num;
+	//add nodes for the new voxels:
+	if(num > pool->voxelCap)
+		_DN_add_voxel_nodes(pool, pool->voxelCap, num);
+
+	//set voxel cap:
+	pool->voxelCap = num;
+	pool->lowUsageFrames = 0;
+	_DN_update_vram_usage(vol);
 
 	return true;
 }
 
-bool DN_set_max_lighting_requests(DNvolume* vol, size_t num)
+bool DN_set_max_upload_requests(DNvolume* vol, size_t num)
 {
-	GLuint* newRequests = DN_REALLOC(vol->lightingRequests, sizeof(GLuint) * num);
-	if(!newRequests)
+	DNuploadRequest* newQueue = DN_REALLOC(vol->uploadQueue, sizeof(DNuploadRequest) * num);
+	if(!newQueue)
 	{
-		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate memory for lighting requests");
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate memory for upload queue");
 		return false;
 	}
 
-	vol->lightingRequests = newRequests;
-	vol->lightingRequestCap = num;
+	vol->uploadQueue = newQueue;
+	vol->uploadQueueCap = num;
 	return true;
 }
 
@@ -1100,7 +2000,13 @@ bool DN_set_max_lighting_requests(DNvolume* vol, size_t num)
 
 bool DN_in_map_bounds(DNvolume* vol, DNivec3 pos)
 {
-	return pos.x < vol->mapSize.x && pos.y < vol->mapSize.y && pos.z < vol->mapSize.z && pos.x >= 0 && pos.y >= 0 && pos.z >= 0;
+	DNivec3 min = vol->mapOrigin;
+	return pos.x >= min.x && pos.y >= min.y && pos.z >= min.z && pos.x - min.x < vol->mapSize.x && pos.y - min.y < vol->mapSize.y && pos.z - min.z < vol->mapSize.z;
+}
+
+int DN_get_map_index(DNvolume* vol, DNivec3 pos)
+{
+	return _DN_wrap_map_index(pos, vol->mapSize);
 }
 
 bool DN_in_chunk_bounds(DNivec3 pos)
@@ -1115,7 +2021,7 @@ DNvoxel DN_get_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
 
 DNcompressedVoxel DN_get_compressed_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
 {
-	return vol->chunks[vol->map[DN_FLATTEN_INDEX(mapPos, vol->mapSize)].chunkIndex].voxels[chunkPos.x][chunkPos.y][chunkPos.z];
+	return vol->chunks[vol->map[DN_get_map_index(vol, mapPos)].chunkIndex].voxels[chunkPos.x][chunkPos.y][chunkPos.z];
 }
 
 void DN_set_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos, DNvoxel voxel)
@@ -1126,7 +2032,7 @@ void DN_set_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos, DNvoxel voxel
 void DN_set_compressed_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos, DNcompressedVoxel voxel)
 {
 	//add new chunk if the requested chunk doesn't yet exist:
-	int mapIndex = DN_FLATTEN_INDEX(mapPos, vol->mapSize);
+	int mapIndex = DN_get_map_index(vol, mapPos);
 	if(vol->map[mapIndex].flag == 0)
 	{
 		if(GET_MATERIAL_ID(voxel.normal) == DN_MATERIAL_EMPTY) //if adding an empty voxel to an empty chunk, just return
@@ -1158,14 +2064,23 @@ void DN_set_compressed_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos, DN
 	//actually set new voxel:
 	vol->chunks[chunkIndex].voxels[chunkPos.x][chunkPos.y][chunkPos.z] = voxel;
 	vol->chunks[chunkIndex].updated = 1;
+
+	//if the voxel's opacity changed, neighboring chunks need to recalculate which of their voxels it hides:
+	bool oldOpaque = oldMat != DN_MATERIAL_EMPTY && vol->materials[oldMat].opacity >= 1.0f;
+	bool newOpaque = newMat != DN_MATERIAL_EMPTY && vol->materials[newMat].opacity >= 1.0f;
+	if(oldOpaque != newOpaque)
+		_DN_mark_neighbors_updated(vol, mapPos, chunkPos);
 }
 
 void DN_remove_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
 {
 	//change number of voxels in map (only if old voxel was solid)
-	int chunkIndex = vol->map[DN_FLATTEN_INDEX(mapPos, vol->mapSize)].chunkIndex;
+	int chunkIndex = vol->map[DN_get_map_index(vol, mapPos)].chunkIndex;
 	if(DN_does_voxel_exist(vol, mapPos, chunkPos))
 	{
+		if(vol->materials[GET_MATERIAL_ID(vol->chunks[chunkIndex].voxels[chunkPos.x][chunkPos.y][chunkPos.z].normal)].opacity >= 1.0f)
+			_DN_mark_neighbors_updated(vol, mapPos, chunkPos);
+
 		vol->chunks[chunkIndex].numVoxels--;
 
 		//remove chunk if no more voxels exist:
@@ -1183,7 +2098,7 @@ void DN_remove_voxel(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
 
 bool DN_does_chunk_exist(DNvolume* vol, DNivec3 pos)
 {
-	return vol->map[DN_FLATTEN_INDEX(pos, vol->mapSize)].flag >= 1;
+	return vol->map[DN_get_map_index(vol, pos)].flag >= 1;
 }
 
 bool DN_does_voxel_exist(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
@@ -1222,13 +2137,6 @@ bool DN_step_map(DNvolume* vol, DNvec3 rayDir, DNvec3 rayPos, int maxSteps, DNiv
 		DNivec3 chunkPos;
 		DN_separate_position(pos, &mapPos, &chunkPos);
 
-		if(pos.x < 0)
-			mapPos.x--;
-		if(pos.y < 0)
-			mapPos.y--;
-		if(pos.z < 0)
-			mapPos.z--;
-
 		//check if voxel exists:
 		if(DN_in_map_bounds(vol, mapPos) && DN_does_chunk_exist(vol, mapPos) && DN_does_voxel_exist(vol, mapPos, chunkPos))
 		{
@@ -1276,8 +2184,11 @@ bool DN_step_map(DNvolume* vol, DNvec3 rayDir, DNvec3 rayPos, int maxSteps, DNiv
 
 void DN_separate_position(DNivec3 pos, DNivec3* mapPos, DNivec3* chunkPos)
 {
-	*mapPos   = (DNivec3){pos.x / DN_CHUNK_SIZE, pos.y / DN_CHUNK_SIZE, pos.z / DN_CHUNK_SIZE};
-	*chunkPos = (DNivec3){pos.x % DN_CHUNK_SIZE, pos.y % DN_CHUNK_SIZE, pos.z % DN_CHUNK_SIZE};
+	//round towards negative infinity so that negative positions end up in the chunk below them:
+	*mapPos = (DNivec3){pos.x >= 0 ? pos.x / DN_CHUNK_SIZE : (pos.x - DN_CHUNK_SIZE + 1) / DN_CHUNK_SIZE,
+	                    pos.y >= 0 ? pos.y / DN_CHUNK_SIZE : (pos.y - DN_CHUNK_SIZE + 1) / DN_CHUNK_SIZE,
+	                    pos.z >= 0 ? pos.z / DN_CHUNK_SIZE : (pos.z - DN_CHUNK_SIZE + 1) / DN_CHUNK_SIZE};
+	*chunkPos = (DNivec3){pos.x - mapPos->x * DN_CHUNK_SIZE, pos.y - mapPos->y * DN_CHUNK_SIZE, pos.z - mapPos->z * DN_CHUNK_SIZE};
 }
 
 DNvec3 DN_cam_dir(DNvec3 orient)
@@ -1350,9 +2261,41 @@ static bool _DN_gen_shader_storage_buffer(GLuint* dest, size_t size)
 	return true;
 }
 
+static void _DN_free_volume(DNvolume* vol)
+{
+	if(vol->completedUploads)
+		DN_queue_free(vol->completedUploads);
+
+	//give the volume's space in the pool back:
+	DNvoxelPool* pool = vol->voxelPool;
+	if(pool)
+	{
+		_DN_release_voxel_nodes(vol);
+		pool->numVolumes--;
+		pool->chunkCap -= vol->chunkCap;
+		pool->mapVramUsage -= _DN_map_vram_usage(vol);
+		pool->vramUsage = pool->mapVramUsage + pool->voxelCap * sizeof(DNvoxelGPU);
+
+		if(vol->ownsVoxelPool)
+			DN_delete_voxel_pool(pool);
+	}
+
+	//unused names are ignored by glDelete*:
+	glDeleteBuffers(1, &vol->glMapBufferID);
+	glDeleteBuffers(1, &vol->glChunkBufferID);
+	glDeleteBuffers(1, &vol->glLightingStatsBufferID);
+	glDeleteQueries(DN_LIGHTING_TIMER_FRAMES, vol->glLightingTimerIDs);
+
+	DN_FREE(vol->map);
+	DN_FREE(vol->chunks);
+	DN_FREE(vol->materials);
+	DN_FREE(vol->uploadQueue);
+	DN_FREE(vol);
+}
+
 static void _DN_clear_chunk(DNvolume* vol, int index)
 {
-	vol->chunks[index].pos = (DNivec3){-1, -1, -1};
+	vol->chunks[index].pos = (DNivec3){INT32_MIN, INT32_MIN, INT32_MIN}; //never in map bounds, whatever the map's origin
 	vol->chunks[index].updated = false;
 	vol->chunks[index].numVoxels = 0;
 
@@ -1362,6 +2305,25 @@ static void _DN_clear_chunk(DNvolume* vol, int index)
 		vol->chunks[index].voxels[x][y][z].normal = UINT32_MAX;
 }
 
+static int _DN_wrap_map_index(DNivec3 pos, DNuvec3 size)
+{
+	int x = pos.x % (int)size.x;
+	int y = pos.y % (int)size.y;
+	int z = pos.z % (int)size.z;
+
+	DNivec3 wrapped = {x < 0 ? x + size.x : x, y < 0 ? y + size.y : y, z < 0 ? z + size.z : z};
+	return DN_FLATTEN_INDEX(wrapped, size);
+}
+
+static void _DN_set_map_origin_uniforms(DNvolume* vol, GLprogram program)
+{
+	int index = DN_get_map_index(vol, vol->mapOrigin);
+	GLuint offset[3] = {index % vol->mapSize.x, index / vol->mapSize.x % vol->mapSize.y, index / (vol->mapSize.x * vol->mapSize.y)};
+
+	glUniform3iv(glGetUniformLocation(program, "mapOrigin"), 1, (GLint*)&vol->mapOrigin);
+	glUniform3uiv(glGetUniformLocation(program, "mapOffset"), 1, offset);
+}
+
 //file i/o and compression:
 
 static void _DN_write_buffer(char** dest, void* src, size_t size)
@@ -1387,309 +2349,1471 @@ static int _DN_find_in_palette(DNbvec3* palette, int paletteSize, DNbvec3 item)
 
 //cpu/gpu streaming:
 
-//returns whether a voxel's face is visible
-static bool _DN_check_face_visible(DNvolume* vol, DNchunk chunk, DNivec3 pos)
+static int _DN_popcount64(uint64_t x)
+{
+#ifdef _MSC_VER
+	return (int)__popcnt64(x);
+#else
+	return __builtin_popcountll(x);
+#endif
+}
+
+static int _DN_count_trailing_zeros64(uint64_t x)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return (int)index;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+static void _DN_get_material_masks(DNvolume* vol, uint32_t* opaqueMaterials, uint32_t* emissiveMaterials)
+{
+	memset(opaqueMaterials, 0, sizeof(uint32_t) * (DN_MAX_MATERIALS / 32));
+	memset(emissiveMaterials, 0, sizeof(uint32_t) * (DN_MAX_MATERIALS / 32));
+	for(int i = 0; i < DN_MAX_MATERIALS; i++)
+	{
+		if(vol->materials[i].opacity >= 1.0f)
+			opaqueMaterials[i >> 5] |= 1u << (i & 31);
+		if(vol->materials[i].emissive)
+			emissiveMaterials[i >> 5] |= 1u << (i & 31);
+	}
+}
+
+static void _DN_build_chunk_masks(const DNchunk* chunk, const uint32_t* opaqueMaterials, uint64_t* solid, uint64_t* opaque)
 {
-	return !DN_in_chunk_bounds(pos) || GET_MATERIAL_ID(chunk.voxels[pos.x][pos.y][pos.z].normal) == DN_MATERIAL_EMPTY || vol->materials[GET_MATERIAL_ID(chunk.voxels[pos.x][pos.y][pos.z].normal)].opacity < 1.0f;
+	for(int z = 0; z < DN_CHUNK_SIZE; z++)
+	{
+		solid[z] = 0;
+		opaque[z] = 0;
+
+		for(int y = 0; y < DN_CHUNK_SIZE; y++)
+		for(int x = 0; x < DN_CHUNK_SIZE; x++)
+		{
+			uint32_t material = GET_MATERIAL_ID(chunk->voxels[x][y][z].normal);
+			if(material == DN_MATERIAL_EMPTY)
+				continue;
+
+			uint64_t bit = (uint64_t)1 << (x + DN_CHUNK_SIZE * y);
+			solid[z] |= bit;
+			if(opaqueMaterials[material >> 5] & (1u << (material & 31)))
+				opaque[z] |= bit;
+		}
+	}
 }
 
-//converts a DNchunk to a DNchunkGPU
-static DNchunkGPU _DN_chunk_to_gpu(DNvolume* vol, DNchunk chunk, int* numVoxels, DNvoxelGPU* voxels)
+static DNchunkGPU _DN_chunk_to_gpu(const DNchunk* chunk, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials, const uint64_t* neighborFaces, int* numVoxels, DNvoxelGPU* voxels)
 {
 	DNchunkGPU res;
-	res.pos = chunk.pos;
+	res.pos = chunk->pos;
 	res.numLightingSamples = 0;
+	res.lightingDeviation = 0;
+	res.sunEpoch = 0;
+	memset(res.sunLit, 0, sizeof(res.sunLit));
+	memset(res.sunShadowed, 0, sizeof(res.sunShadowed));
+	res.numEmissive = 0;
+	res.emissivePower = 0.0f;
+	res.lightListed = 0;
+	res.lightingSamples = 0;
+	memset(res.emissiveMask, 0, sizeof(res.emissiveMask));
+	res.lightingLod = 0;
+	res.lastLit = 0;
+
+	//build a 64 bit mask for every z slice (bit = x + 8 * y):
+	uint64_t solid[DN_CHUNK_SIZE];
+	uint64_t opaque[DN_CHUNK_SIZE];
+	_DN_build_chunk_masks(chunk, opaqueMaterials, solid, opaque);
+
+	//a voxel is hidden if all 6 of its neighbors are opaque, voxels on the chunk's border check the neighboring chunk's face:
+	uint64_t exposed[DN_CHUNK_SIZE];
+	for(int z = 0; z < DN_CHUNK_SIZE; z++)
+	{
+		uint64_t rowShift = z * DN_CHUNK_SIZE;
 
-	//reset bitmask:
-	for(int i = 0; i < 16; i++)
-		res.bitMask[i] = 0;
+		uint64_t covered = (((opaque[z] >> 1) & ~CHUNK_MASK_MAX_X) | _DN_face_row_to_column(neighborFaces[0] >> rowShift, DN_CHUNK_SIZE - 1)) & //+x neighbor
+		                   (((opaque[z] << 1) & ~CHUNK_MASK_MIN_X) | _DN_face_row_to_column(neighborFaces[1] >> rowShift, 0)) &                  //-x neighbor
+		                   ((opaque[z] >> DN_CHUNK_SIZE) | (((neighborFaces[2] >> rowShift) & 0xFF) << (DN_CHUNK_SIZE * (DN_CHUNK_SIZE - 1)))) & //+y neighbor
+		                   ((opaque[z] << DN_CHUNK_SIZE) | ((neighborFaces[3] >> rowShift) & 0xFF)) &                                          //-y neighbor
+		                   (z < DN_CHUNK_SIZE - 1 ? opaque[z + 1] : neighborFaces[4]) &                                                       //+z neighbor
+		                   (z > 0                 ? opaque[z - 1] : neighborFaces[5]);                                                        //-z neighbor
 
-	int n = 0;
+		exposed[z] = solid[z] & ~covered;
+	}
+
+	//set bitmask and partial counts (each slice is 2 words of the bitmask, so each quarter is 2 slices):
 	for(int z = 0; z < DN_CHUNK_SIZE; z++)
-	for(int y = 0; y < DN_CHUNK_SIZE; y++)
-	for(int x = 0; x < DN_CHUNK_SIZE; x++)
 	{
-		//get index:
-		DNivec3 pos = (DNivec3){x, y, z};
-		unsigned int index = pos.x + DN_CHUNK_SIZE * (pos.y + DN_CHUNK_SIZE * pos.z);
-
-		//set partial count:
-		if((index & 31) == 0 && index != 0 && ((index >> 5) & 3) == 0)
-			res.partialCounts[(index >> 7) - 1] = n;
+		res.bitMask[z * 2    ] = (uint32_t)exposed[z];
+		res.bitMask[z * 2 + 1] = (uint32_t)(exposed[z] >> 32);
+	}
 
-		//exit if voxel is empty or if not visible:
-		if(GET_MATERIAL_ID(chunk.voxels[x][y][z].normal) == DN_MATERIAL_EMPTY)
-			continue;
+	res.partialCounts[0] = _DN_popcount64(exposed[0]) + _DN_popcount64(exposed[1]);
+	res.partialCounts[1] = _DN_popcount64(exposed[2]) + _DN_popcount64(exposed[3]) + res.partialCounts[0];
+	res.partialCounts[2] = _DN_popcount64(exposed[4]) + _DN_popcount64(exposed[5]) + res.partialCounts[1];
 
-		bool visible = false;
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x + 1, y, z});
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x - 1, y, z});
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x, y + 1, z});
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x, y - 1, z});
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x, y, z + 1});
-		visible = visible || _DN_check_face_visible(vol, chunk, (DNivec3){x, y, z - 1});
-		if(!visible)
-			continue;
+	//gather exposed voxels, in index order:
+	uint32_t normals[DN_CHUNK_LENGTH];
+	uint32_t albedos[DN_CHUNK_LENGTH];
+	uint32_t localIndices[DN_CHUNK_LENGTH];
+	int n = 0;
+	for(int z = 0; z < DN_CHUNK_SIZE; z++)
+	{
+		uint64_t bits = exposed[z];
+		while(bits)
+		{
+			int i = _DN_count_trailing_zeros64(bits);
+			bits &= bits - 1;
 
-		//set bitmask:
-		res.bitMask[index >> 5] |= 1 << (index & 31);
+			DNcompressedVoxel voxel = chunk->voxels[i & (DN_CHUNK_SIZE - 1)][i / DN_CHUNK_SIZE][z];
 
-		//linearize albedo:
-		uint32_t readAlbedo = chunk.voxels[x][y][z].albedo;
-		DNcolor albedo = {(readAlbedo >> 24) & 0xFF, (readAlbedo >> 16) & 0xFF, (readAlbedo >> 8) & 0xFF};
+			//linearize albedo:
+			uint32_t material = GET_MATERIAL_ID(voxel.normal);
+			uint32_t albedo = ((uint32_t)g_gammaTable[(voxel.albedo >> 24) & 0xFF] << 24) | 
+			                  ((uint32_t)g_gammaTable[(voxel.albedo >> 16) & 0xFF] << 16) | 
+			                  ((uint32_t)g_gammaTable[(voxel.albedo >>  8) & 0xFF] <<  8) | material;
 
-		DNvec3 linearized = DN_vec3_scale((DNvec3){albedo.r, albedo.g, albedo.b}, 0.00392156862f);
-		linearized.x = powf(linearized.x, DN_GAMMA);
-		linearized.y = powf(linearized.y, DN_GAMMA);
-		linearized.z = powf(linearized.z, DN_GAMMA);
-		linearized = DN_vec3_scale(linearized, 255.0f);
+			//add emissive voxels to the chunk's lights, their albedo is the light they emit:
+			uint32_t localIndex = z * DN_CHUNK_SIZE * DN_CHUNK_SIZE + i;
+			if(emissiveMaterials[material >> 5] & (1u << (material & 31)))
+			{
+				res.emissiveMask[localIndex >> 5] |= 1u << (localIndex & 31);
+				res.numEmissive++;
+				res.emissivePower += (0.2126f * ((albedo >> 24) & 0xFF) + 0.7152f * ((albedo >> 16) & 0xFF) + 0.0722f * ((albedo >> 8) & 0xFF)) * 0.00392156862f;
+			}
 
-		albedo = (DNcolor){linearized.x, linearized.y, linearized.z};
-		readAlbedo = (albedo.r << 24) | (albedo.g << 16) | (albedo.b << 8);
+			normals[n] = voxel.normal;
+			albedos[n] = albedo;
+			localIndices[n] = localIndex;
+			n++;
+		}
+	}
 
-		//set voxel:
-		DNvoxelGPU vox;
-		vox.normal = chunk.voxels[x][y][z].normal;
-		vox.directLight = readAlbedo;
-		vox.diffuseLight = 0;
-		vox.specLight = 0;
-		voxels[n++] = vox;
+	//pack voxels (lighting starts at 0, voxels that were already on the gpu get theirs back from voxelLightingRemap.comp):
+	int i = 0;
+#if QM_USE_SSE
+	//4 at a time, the words of 4 voxels are interleaved into their records:
+	for(; i + 4 <= n; i += 4)
+	{
+		__m128i albedo = _mm_loadu_si128((__m128i*)&albedos[i]);
+		#ifdef DN_COMPACT_VOXELS
+		__m128i normal = _DN_octahedral_normals_sse(_mm_loadu_si128((__m128i*)&normals[i]));
+
+		//4 records of 3 words fill 3 vectors: {n0, a0, 0, n1}, {a1, 0, n2, a2}, {0, n3, a3, 0}
+		__m128i lo = _mm_unpacklo_epi32(normal, albedo);
+		__m128i hi = _mm_unpackhi_epi32(normal, albedo);
+		__m128i first  = _mm_and_si128(_mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 0, 1, 0)), _mm_setr_epi32(-1, -1, 0, -1));
+		__m128i second = _mm_and_si128(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(1, 0, 3, 3))), _mm_setr_epi32(-1, 0, -1, -1));
+		__m128i third  = _mm_and_si128(_mm_shuffle_epi32(hi, _MM_SHUFFLE(0, 3, 2, 0)), _mm_setr_epi32(0, -1, -1, 0));
+		_mm_storeu_si128((__m128i*)&voxels[i]              , first);
+		_mm_storeu_si128((__m128i*)((GLuint*)&voxels[i] + 4), second);
+		_mm_storeu_si128((__m128i*)((GLuint*)&voxels[i] + 8), third);
+		#else
+		__m128i normal = _mm_or_si128(_DN_octahedral_normals_sse(_mm_loadu_si128((__m128i*)&normals[i])), _mm_loadu_si128((__m128i*)&localIndices[i]));
+
+		__m128i lo = _mm_unpacklo_epi32(normal, albedo);
+		__m128i hi = _mm_unpackhi_epi32(normal, albedo);
+		__m128i zero = _mm_setzero_si128();
+		_mm_storeu_si128((__m128i*)&voxels[i    ], _mm_unpacklo_epi64(lo, zero));
+		_mm_storeu_si128((__m128i*)&voxels[i + 1], _mm_unpackhi_epi64(lo, zero));
+		_mm_storeu_si128((__m128i*)&voxels[i + 2], _mm_unpacklo_epi64(hi, zero));
+		_mm_storeu_si128((__m128i*)&voxels[i + 3], _mm_unpackhi_epi64(hi, zero));
+		#endif
+	}
+#endif
+	for(; i < n; i++)
+	{
+		#ifdef DN_COMPACT_VOXELS
+		voxels[i] = (DNvoxelGPU){_DN_octahedral_normal(normals[i]), albedos[i], 0};
+		#else
+		voxels[i] = (DNvoxelGPU){_DN_octahedral_normal(normals[i]) | localIndices[i], albedos[i], 0, 0};
+		#endif
 	}
 
 	*numVoxels = n;
 	return res;
 }
 
-static void _DN_request_chunk_lighting(DNvolume* vol, DNchunkHandle* cpuMap, int mapIndex, int gpuFlag, int gpuChunkIndex, bool gpuVisible, int lightingSplit)
+static uint32_t _DN_octahedral_normal(uint32_t normal)
 {
-	//if chunk isnt loaded or visible, return:
-	if(gpuFlag != 2 || !gpuVisible)
-		return;
-
-	//if chunk isnt included in current lighting split and isnt updated, return:
-	if(mapIndex % lightingSplit != vol->frameNum && !vol->chunks[cpuMap[mapIndex].chunkIndex].updated)
-		return;
-
-	//resize the lighting request buffer if not large enough:
-	if(vol->numLightingRequests + (DN_CHUNK_LENGTH / LIGHTING_WORKGROUP_SIZE) >= vol->lightingRequestCap)
+	float x = (int)((normal >> 16) & 0xFF) * 2 - 255;
+	float y = (int)((normal >>  8) & 0xFF) * 2 - 255;
+	float z = (int)( normal        & 0xFF) * 2 - 255;
+
+	//project onto the octahedron, zero normals point along +z:
+	float sum = fabsf(x) + fabsf(y) + fabsf(z);
+	if(sum == 0.0f)
+		return OCTAHEDRAL_UP;
+
+	x /= sum;
+	y /= sum;
+	if(z < 0.0f) //fold the lower hemisphere over the upper one
 	{
-		size_t newCap = vol->lightingRequestCap * 2;
-
-		char message[256];
-		sprintf(message, "automatically resizing lighting request memory to accomodate %zi requests (%zi bytes)", newCap, newCap * sizeof(GLuint));
-		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_NOTE, message);
-
-		if(!DN_set_max_lighting_requests(vol, newCap))
-			return;
+		float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
 	}
 
-	//add requests (enough to cover all the voxels)
-	for(int i = 0; i < vol->chunks[cpuMap[mapIndex].chunkIndex].numVoxelsGpu; i += LIGHTING_WORKGROUP_SIZE)
-		vol->lightingRequests[vol->numLightingRequests++] = (mapIndex << 4) | (i / LIGHTING_WORKGROUP_SIZE);;
+	uint32_t octX = (uint32_t)((x * 0.5f + 0.5f) * OCTAHEDRAL_MAX + 0.5f);
+	uint32_t octY = (uint32_t)((y * 0.5f + 0.5f) * OCTAHEDRAL_MAX + 0.5f);
+	return (octX << (32 - OCTAHEDRAL_BITS)) | (octY << (32 - 2 * OCTAHEDRAL_BITS));
 }
 
-static void _DN_stream_to_gpu(DNvolume* vol, DNchunkHandle* cpuMap, DNchunkHandleGPU* gpuMap, DNivec3 pos, int mapIndex, int* gpuFlag, int gpuChunkIndex, bool* resizeVoxels)
+#if QM_USE_SSE
+
+static __m128i _DN_octahedral_normals_sse(__m128i normal)
 {
-	//if a chunk was added to the cpu map, add it to the gpu map:
-	if(cpuMap[mapIndex].flag != 0 && *gpuFlag == 0)
-	{
-		gpuMap[mapIndex].flags = 1;
-		*gpuFlag = 1;
-	}
-	else if(cpuMap[mapIndex].flag == 0 && *gpuFlag != 0) //if chunk was removed from the cpu map, remove it from the gpu map
-	{
-		if(*gpuFlag == 2)
-			_DN_unload_voxels(vol, mapIndex, gpuChunkIndex);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const __m128i offset = _mm_set1_epi32(255);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 scale = _mm_set1_ps((float)OCTAHEDRAL_MAX);
+
+	__m128 x = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(normal, 16), byteMask), 1), offset));
+	__m128 y = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(normal,  8), byteMask), 1), offset));
+	__m128 z = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_slli_epi32(_mm_and_si128(normal, byteMask), 1), offset));
+
+	//project onto the octahedron:
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(signBit, x), _mm_andnot_ps(signBit, y)), _mm_andnot_ps(signBit, z));
+	__m128 zeroNormal = _mm_cmpeq_ps(sum, zero);
+	sum = _mm_or_ps(_mm_andnot_ps(zeroNormal, sum), _mm_and_ps(zeroNormal, one));
+	x = _mm_div_ps(x, sum);
+	y = _mm_div_ps(y, sum);
+
+	//fold the lower hemisphere over the upper one, multiplying by -1 only flips the sign bit:
+	__m128 lower = _mm_cmplt_ps(z, zero);
+	__m128 foldedX = _mm_xor_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, y)), _mm_and_ps(_mm_cmplt_ps(x, zero), signBit));
+	__m128 foldedY = _mm_xor_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, x)), _mm_and_ps(_mm_cmplt_ps(y, zero), signBit));
+	x = _mm_or_ps(_mm_andnot_ps(lower, x), _mm_and_ps(lower, foldedX));
+	y = _mm_or_ps(_mm_andnot_ps(lower, y), _mm_and_ps(lower, foldedY));
+
+	__m128i octX = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, half), half), scale), half));
+	__m128i octY = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(y, half), half), scale), half));
+	__m128i res = _mm_or_si128(_mm_slli_epi32(octX, 32 - OCTAHEDRAL_BITS), _mm_slli_epi32(octY, 32 - 2 * OCTAHEDRAL_BITS));
+
+	//zero normals point along +z:
+	__m128i zeroMask = _mm_castps_si128(zeroNormal);
+	return _mm_or_si128(_mm_andnot_si128(zeroMask, res), _mm_and_si128(zeroMask, _mm_set1_epi32(OCTAHEDRAL_UP)));
+}
 
-		gpuMap[mapIndex].flags = 0;
-		*gpuFlag = 0;
-	}
+#endif
 
-	//if updated, unload and request it to let the streaming system handle it
-	if(*gpuFlag == 2 && vol->chunks[cpuMap[mapIndex].chunkIndex].updated)
-	{
-		_DN_unload_voxels(vol, mapIndex, gpuChunkIndex);
+static uint64_t _DN_get_neighbor_face(DNvolume* vol, DNivec3 mapPos, int dir, const uint32_t* opaqueMaterials)
+{
+	const DNivec3 offsets[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+	int axis = dir / 2;
+	int depth = (dir & 1) ? DN_CHUNK_SIZE - 1 : 0; //the slice of the neighbor that touches this chunk
 
-		gpuMap[mapIndex].flags = 3;
-		*gpuFlag = 3;
-	}
+	//chunks on the edge of the map or next to empty tiles are exposed:
+	DNivec3 neighborPos = {mapPos.x + offsets[dir].x, mapPos.y + offsets[dir].y, mapPos.z + offsets[dir].z};
+	if(!DN_in_map_bounds(vol, neighborPos) || vol->map[DN_get_map_index(vol, neighborPos)].flag == 0)
+		return 0;
 
-	//if flag = 3 (requested), try to load a new chunk:
-	if(*gpuFlag == 3 && cpuMap[mapIndex].flag != 0)
-	{
-		unsigned int numVoxels;
-		DNvoxelGPU gpuVoxels[DN_CHUNK_LENGTH];
-		DNchunkGPU gpuChunk = _DN_chunk_to_gpu(vol, vol->chunks[cpuMap[mapIndex].chunkIndex], &numVoxels, gpuVoxels);
-		vol->chunks[cpuMap[mapIndex].chunkIndex].numVoxelsGpu = numVoxels;
+	const DNchunk* neighbor = &vol->chunks[vol->map[DN_get_map_index(vol, neighborPos)].chunkIndex];
 
-		gpuMap[mapIndex].flags = 2;
-		gpuMap[mapIndex].lastUsed = 0;
+	//bit = a + 8 * b, where a and b are the remaining 2 axes in xyz order:
+	uint64_t face = 0;
+	for(int b = 0; b < DN_CHUNK_SIZE; b++)
+	for(int a = 0; a < DN_CHUNK_SIZE; a++)
+	{
+		DNcompressedVoxel voxel;
+		if(axis == 0)
+			voxel = neighbor->voxels[depth][a][b];
+		else if(axis == 1)
+			voxel = neighbor->voxels[a][depth][b];
+		else
+			voxel = neighbor->voxels[a][b][depth];
 
-		_DN_stream_chunk(vol, mapIndex, gpuChunk);
-		if(_DN_stream_voxels(vol, pos, gpuMap, mapIndex, numVoxels, gpuVoxels))
-			*resizeVoxels = true;
+		uint32_t material = GET_MATERIAL_ID(voxel.normal);
+		if(material != DN_MATERIAL_EMPTY && (opaqueMaterials[material >> 5] & (1u << (material & 31))))
+			face |= (uint64_t)1 << (a + DN_CHUNK_SIZE * b);
 	}
 
-	//set updated flag to false:
-	if(cpuMap[mapIndex].flag != 0)
-		vol->chunks[cpuMap[mapIndex].chunkIndex].updated = false;
+	return face;
 }
 
-static void _DN_unload_voxels(DNvolume* vol, int mapIndex, int chunkIndex)
+static uint64_t _DN_face_row_to_column(uint64_t row, int x)
 {
-	for(int i = 0; i < vol->numVoxelNodes; i++)
-		if(DN_in_map_bounds(vol, vol->gpuVoxelLayout[i].chunkPos) && DN_FLATTEN_INDEX(vol->gpuVoxelLayout[i].chunkPos, vol->mapSize) == mapIndex)
-		{
-			vol->gpuVoxelLayout[i].chunkPos.x = -1;
-			break;
-		}
+	uint64_t column = 0;
+	for(int i = 0; i < DN_CHUNK_SIZE; i++)
+		column |= ((row >> i) & 1) << (x + DN_CHUNK_SIZE * i);
+
+	return column;
 }
 
-static void _DN_stream_chunk(DNvolume* vol, int mapIndex, DNchunkGPU chunk)
+static void _DN_mark_chunk_updated(DNvolume* vol, DNivec3 mapPos)
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glChunkBufferID);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, mapIndex * sizeof(DNchunkGPU), sizeof(DNchunkGPU), &chunk);
+	if(!DN_in_map_bounds(vol, mapPos))
+		return;
+
+	DNchunkHandle handle = vol->map[DN_get_map_index(vol, mapPos)];
+	if(handle.flag != 0)
+		vol->chunks[handle.chunkIndex].updated = true;
 }
 
-static bool _DN_stream_voxels(DNvolume* vol, DNivec3 pos, DNchunkHandleGPU* mapGPU, int mapIndex, int numVoxels, DNvoxelGPU* voxels)
+static void _DN_mark_neighbors_updated(DNvolume* vol, DNivec3 mapPos, DNivec3 chunkPos)
 {
-	//calculate needed node size:
-	int nodeSize = 16;
-	while(nodeSize < numVoxels)
-		nodeSize *= 2;
-
-	//loop over and find the smallest and least used node:
-	uint32_t maxTime = 0;
-	int maxTimeNodeSize = -1;
-	int maxTimeIndex = -1;
-	int maxTimeMapIndex = -1;
+	if(chunkPos.x == 0)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x - 1, mapPos.y, mapPos.z});
+	else if(chunkPos.x == DN_CHUNK_SIZE - 1)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x + 1, mapPos.y, mapPos.z});
+
+	if(chunkPos.y == 0)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x, mapPos.y - 1, mapPos.z});
+	else if(chunkPos.y == DN_CHUNK_SIZE - 1)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x, mapPos.y + 1, mapPos.z});
+
+	if(chunkPos.z == 0)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x, mapPos.y, mapPos.z - 1});
+	else if(chunkPos.z == DN_CHUNK_SIZE - 1)
+		_DN_mark_chunk_updated(vol, (DNivec3){mapPos.x, mapPos.y, mapPos.z + 1});
+}
 
-	for(int i = 0; i < vol->numVoxelNodes; i++)
+static void _DN_chunk_worker(void* arg)
+{
+	while(true)
 	{
-		//continue if node is too small:
-		if(vol->gpuVoxelLayout[i].size < nodeSize)
-			continue;
+		DN_semaphore_wait(g_chunkJobSemaphore);
+		if(!DN_atomic_load(&g_workersRunning))
+			return;
 
-		//get position and index of chunk:
-		DNivec3 currentPos = vol->gpuVoxelLayout[i].chunkPos;
-		unsigned int currentIndex = DN_FLATTEN_INDEX(currentPos, vol->mapSize);
+		DNchunkJob* job;
+		while(DN_queue_pop(g_chunkJobs, (void**)&job))
+			_DN_process_chunk_job(job);
+	}
+}
 
-		//see if chunk is older or has a smaller node:
-		uint32_t time = DN_in_map_bounds(vol, currentPos) ? mapGPU[currentIndex].lastUsed : UINT32_MAX;
-		if(time > maxTime || (time == UINT32_MAX && vol->gpuVoxelLayout[i].size < maxTimeNodeSize))
-		{
-			maxTime = time;
-			maxTimeNodeSize = vol->gpuVoxelLayout[i].size;
-			maxTimeIndex = i;
-			maxTimeMapIndex = currentIndex;
-		}
+static void _DN_process_chunk_job(DNchunkJob* job)
+{
+	job->gpuChunk = _DN_chunk_to_gpu(&job->chunk, job->opaqueMaterials, job->emissiveMaterials, job->neighborFaces, &job->numVoxels, job->voxels);
 
-		//if unloaded chunk with optimal node size is found, early exit:
-		if(maxTimeNodeSize == nodeSize && maxTime == UINT32_MAX)
-			break;
-	}
+	//the queue can hold every job the volume has pending, so this only fails while another thread is mid-push:
+	while(!DN_queue_push(job->vol->completedUploads, job))
+		DN_thread_yield();
+}
 
-	//if there isn't enough space, unload corresponding chunk and return true to double the size of the voxel buffer:
-	if(maxTimeIndex < 0 || maxTime <= 1)
+static bool _DN_submit_chunk_job(DNvolume* vol, int mapIndex, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials)
+{
+	if(vol->numPendingUploads >= COMPLETED_UPLOAD_QUEUE_SIZE)
+		return false;
+
+	DNchunkJob* job = DN_MALLOC(sizeof(DNchunkJob));
+	if(!job)
 	{
-		mapGPU[mapIndex].flags = 1;
-		return true;
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to allocate memory for chunk upload");
+		return false;
 	}
 
-	//unload old one if overwritten:
-	if(DN_in_map_bounds(vol, vol->gpuVoxelLayout[maxTimeIndex].chunkPos))
-		mapGPU[maxTimeMapIndex].flags = 1;
+	job->vol = vol;
+	job->mapIndex = mapIndex;
+	memcpy(job->opaqueMaterials, opaqueMaterials, sizeof(job->opaqueMaterials));
+	memcpy(job->emissiveMaterials, emissiveMaterials, sizeof(job->emissiveMaterials));
+	job->chunk = vol->chunks[vol->map[mapIndex].chunkIndex];
+	for(int i = 0; i < 6; i++)
+		job->neighborFaces[i] = _DN_get_neighbor_face(vol, job->chunk.pos, i, opaqueMaterials);
+
+	//any changes made after the copy will be picked up by the next job:
+	vol->chunks[vol->map[mapIndex].chunkIndex].updated = false;
+	vol->map[mapIndex].uploadPending = true;
+	vol->numPendingUploads++;
+
+	//hand off to a worker thread, or prepare it right away if there are none (or the queue is full):
+	if(g_numWorkerThreads > 0 && DN_queue_push(g_chunkJobs, job))
+		DN_semaphore_post(g_chunkJobSemaphore);
+	else
+		_DN_process_chunk_job(job);
+
+	return true;
+}
 
-	//split a node if needed
-	if(maxTimeNodeSize > nodeSize)
+static void _DN_upload_completed_chunks(DNvolume* vol, DNchunkHandleGPU* gpuMap, uint32_t* missingNodeSize)
+{
+	//chunks left in the queue once the budget is reached are uploaded next frame:
+	size_t numChunks = 0;
+	size_t numBytes = 0;
+
+	DNchunkJob* job;
+	while((vol->maxUploadChunks == 0 || numChunks < vol->maxUploadChunks) && (vol->maxUploadBytes == 0 || numBytes < vol->maxUploadBytes) && DN_queue_pop(vol->completedUploads, (void**)&job))
 	{
-		//determine how many splits need to be made:
-		int numAdded = 0;
-		while(maxTimeNodeSize > nodeSize)
+		int mapIndex = job->mapIndex;
+		vol->map[mapIndex].uploadPending = false;
+		vol->numPendingUploads--;
+
+		//skip chunks that were removed while being prepared, or replaced by a different chunk when the map's origin moved:
+		DNivec3 pos = vol->chunks[vol->map[mapIndex].chunkIndex].pos;
+		if(vol->map[mapIndex].flag == 0 || (gpuMap[mapIndex].flags & 3) == 0 || pos.x != job->chunk.pos.x || pos.y != job->chunk.pos.y || pos.z != job->chunk.pos.z)
 		{
-			maxTimeNodeSize /= 2;
-			numAdded++;
+			DN_FREE(job);
+			continue;
 		}
 
-		//shift all mem over:
-		int orgStartPos = vol->gpuVoxelLayout[maxTimeIndex].startPos;
-		memmove(&vol->gpuVoxelLayout[maxTimeIndex + numAdded], &vol->gpuVoxelLayout[maxTimeIndex], sizeof(DNvoxelNode) * (vol->numVoxelNodes - maxTimeIndex));
+		//a chunk that is already loaded keeps its lighting, copy it out before it gets overwritten:
+		if((gpuMap[mapIndex].flags & 3) == 2 && vol->map[mapIndex].voxelNode >= 0 && job->numVoxels > 0)
+			_DN_stage_lighting_remap(vol, mapIndex);
 
-		//set new nodes:
-		int mult = 1;
-		for(int i = maxTimeIndex; i <= maxTimeIndex + numAdded; i++)
+		vol->chunks[vol->map[mapIndex].chunkIndex].numVoxelsGpu = job->numVoxels;
+
+		gpuMap[mapIndex].flags = 2;
+		gpuMap[mapIndex].lastUsed = 0;
+
+		_DN_stream_chunk(vol, mapIndex, job->gpuChunk);
+		_DN_invalidate_shadows(vol, mapIndex);
+		if(_DN_stream_voxels(vol, mapIndex, job->numVoxels, job->voxels))
 		{
-			vol->gpuVoxelLayout[i].size = nodeSize * mult;
-			vol->gpuVoxelLayout[i].startPos = orgStartPos + (i == maxTimeIndex ? 0 : nodeSize * mult);
-			vol->gpuVoxelLayout[i].chunkPos.x = -1;
+			uint32_t nodeSize = 16;
+			while(nodeSize < job->numVoxels)
+				nodeSize *= 2;
 
-			if(i > maxTimeIndex)
-				mult *= 2;
+			if(nodeSize > *missingNodeSize)
+				*missingNodeSize = nodeSize;
 		}
 
-		vol->numVoxelNodes += numAdded;
+		numChunks++;
+		numBytes += sizeof(DNchunkGPU) + job->numVoxels * sizeof(DNvoxelGPU);
+
+		DN_FREE(job);
 	}
+}
 
-	//send data:
-	vol->gpuVoxelLayout[maxTimeIndex].chunkPos = pos;
-	mapGPU[mapIndex].voxelIndex = vol->gpuVoxelLayout[maxTimeIndex].startPos;
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glVoxelBufferID);
-	glBufferSubData(GL_SHADER_STORAGE_BUFFER, vol->gpuVoxelLayout[maxTimeIndex].startPos * sizeof(DNvoxelGPU), numVoxels * sizeof(DNvoxelGPU), voxels);
+static void _DN_stage_lighting_remap(DNvolume* vol, int mapIndex)
+{
+	if(g_numLightingRemaps >= g_maxLightingRemaps)
+	{
+		g_lightingRemapOverflow = true;
+		return;
+	}
 
-	return false;
+	DNvoxelPool* pool = vol->voxelPool;
+	DNvoxelNode node = pool->gpuVoxelLayout[vol->map[mapIndex].voxelNode];
+	GLintptr remapOffset = g_numLightingRemaps * sizeof(DNlightingRemapGPU);
+	g_numLightingRemaps++;
+
+	//copy the chunk and its voxels (nodes never cross pages or hold more than a chunk's voxels):
+	glBindBuffer(GL_COPY_WRITE_BUFFER, g_lightingRemapBuffer);
+	glBindBuffer(GL_COPY_READ_BUFFER, vol->glChunkBufferID);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mapIndex * sizeof(DNchunkGPU), remapOffset + offsetof(DNlightingRemapGPU, oldChunk), sizeof(DNchunkGPU));
+
+	size_t offset;
+	glBindBuffer(GL_COPY_READ_BUFFER, _DN_get_voxel_page(pool, node.startPos, &offset));
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset * sizeof(DNvoxelGPU), remapOffset + offsetof(DNlightingRemapGPU, oldVoxels), fmin(node.size, DN_CHUNK_LENGTH) * sizeof(DNvoxelGPU));
+
+	GLuint remapMapIndex = mapIndex;
+	glBufferSubData(GL_COPY_WRITE_BUFFER, remapOffset + offsetof(DNlightingRemapGPU, mapIndex), sizeof(GLuint), &remapMapIndex);
 }
 
-static void _DN_sort_gpu_voxel_buffer(DNvolume* vol, DNchunkHandleGPU* gpuMap, int maxCopies)
+static void _DN_remap_lighting(DNvolume* vol)
 {
-	//desired layout: all used nodes (in arbitrary order) | all unused nodes (in descending order)
+	if(g_numLightingRemaps > 0)
+	{
+		glUseProgram(g_lightingRemapProgram);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vol->glMapBufferID);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vol->glChunkBufferID);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_lightingRemapBuffer);
+		_DN_bind_voxel_pages(vol->voxelPool, g_lightingRemapProgram);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		glDispatchCompute(g_numLightingRemaps, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g_lightingRequestBuffer);
+		g_numLightingRemaps = 0;
+	}
 
-	int numCopies = 0;
-	for(int i = 0; i < vol->numVoxelNodes - 1; i++) //TODO: there's definitely a better algo than bubble sort, but for now its fine
+	//grow the buffer if chunks had to start with no lighting because it was full:
+	if(g_lightingRemapOverflow)
 	{
-		//sort:
-		DNvoxelNode cur  = vol->gpuVoxelLayout[i];
-		DNvoxelNode next = vol->gpuVoxelLayout[i + 1];
+		size_t newCap = g_maxLightingRemaps * 2;
 
-		//if the current one is in use, dont swap
-		if(DN_in_map_bounds(vol, cur.chunkPos))
-			continue;
+		char message[256];
+		sprintf(message, "automatically resizing lighting remap buffer to accomodate %zi chunks (%zi bytes)", newCap, newCap * sizeof(DNlightingRemapGPU));
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_NOTE, message);
+
+		_DN_clear_gl_errors();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_lightingRemapBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, newCap * sizeof(DNlightingRemapGPU), NULL, GL_DYNAMIC_DRAW);
+		if(_DN_gl_error())
+		{
+			g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to resize lighting remap buffer");
+			return;
+		}
+		g_maxLightingRemaps = newCap;
+		g_lightingRemapOverflow = false;
+	}
+}
 
-		//if the next one is in use (the current one isnt) or is smaller than the current one, swap them
-		if(DN_in_map_bounds(vol, next.chunkPos) || next.size < cur.size)
-		{	
-			numCopies++;
+static void _DN_read_lighting_timers(DNvolume* vol, bool wait)
+{
+	//read the oldest queries first, stopping at the first one that isn't finished:
+	for(int i = 0; i < DN_LIGHTING_TIMER_FRAMES; i++)
+	{
+		uint32_t slot = (vol->lightingTimerFrame + i) % DN_LIGHTING_TIMER_FRAMES;
+		if(!(vol->lightingTimersPending & (1u << slot)))
+			continue;
 
-			//copy to the empty space at the end of the buffer, then swap
-			if(DN_in_map_bounds(vol, next.chunkPos))
-			{
-				glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glVoxelBufferID);
-				glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER, next.startPos * sizeof(DNvoxelGPU), vol->voxelCap * sizeof(DNvoxelGPU), next.size * sizeof(DNvoxelGPU));
-				glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_SHADER_STORAGE_BUFFER, vol->voxelCap * sizeof(DNvoxelGPU), (next.startPos - cur.size) * sizeof(DNvoxelGPU), next.size * sizeof(DNvoxelGPU));
+		GLint available = 0;
+		if(!(wait && i == 0))
+		{
+			glGetQueryObjectiv(vol->glLightingTimerIDs[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available)
+				break;
+		}
 
-				gpuMap[DN_FLATTEN_INDEX(next.chunkPos, vol->mapSize)].voxelIndex = next.startPos - cur.size;
-			}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(vol->glLightingTimerIDs[slot], GL_QUERY_RESULT, &elapsed);
+		vol->lightingTimersPending &= ~(1u << slot);
 
-			next.startPos -= cur.size;
-			cur.startPos += next.size;
+		//x = lights, y = samples taken, z = rays traced, w = the number of tiles the budget reached (UINT32_MAX if it reached all of them),
+		//followed by x = voxels in the work list, y = the threads that per-chunk work groups would have needed for them, z = the words of
+		//map and chunk data that the chunk cache saved reading (signed), w = the words still read from the buffers,
+		//followed by the wavefront statistics, x = the number of voxels skipped because their rays didn't fit in the queues:
+		GLuint stats[12] = {0, 0, 0, UINT32_MAX, 0, 0, 0, 0, 0, 0, 0, 0};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glLightingStatsBufferID);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * LIGHTING_STATS_SIZE, LIGHTING_STATS_SIZE, stats);
 
-			vol->gpuVoxelLayout[i] = next;
-			vol->gpuVoxelLayout[i + 1] = cur;
+		vol->lightingTime = elapsed * 0.000001f;
+		if(vol->lightingTime > 0.0f && stats[1] > 0)
+		{
+			float rate = stats[1] / vol->lightingTime;
+			if(vol->lightingSamplesPerMs > 0.0f)
+				vol->lightingSamplesPerMs += (rate - vol->lightingSamplesPerMs) * LIGHTING_SAMPLE_RATE_SMOOTHING;
+			else
+				vol->lightingSamplesPerMs = rate;
+		}
+		if(vol->lightingTime > 0.0f && stats[2] > 0)
+		{
+			float rate = stats[2] / vol->lightingTime;
+			if(vol->lightingRaysPerMs > 0.0f)
+				vol->lightingRaysPerMs += (rate - vol->lightingRaysPerMs) * LIGHTING_SAMPLE_RATE_SMOOTHING;
+			else
+				vol->lightingRaysPerMs = rate;
 		}
 
-		//merge adjavent empty nodes together:
-		if(!DN_in_map_bounds(vol, next.chunkPos) && cur.size == next.size && cur.size < DN_CHUNK_LENGTH)
+		if(stats[4] > 0)
 		{
-			numCopies++;
+			uint32_t numThreads = (stats[4] + LIGHTING_WORKGROUP_SIZE - 1) / LIGHTING_WORKGROUP_SIZE * LIGHTING_WORKGROUP_SIZE;
+			vol->lightingOccupancy = (float)stats[4] / numThreads;
+			vol->lightingChunkOccupancy = (float)stats[4] / stats[5];
+		}
 
-			vol->gpuVoxelLayout[i].size *= 2;
+		int32_t cacheSaved = (int32_t)stats[6];
+		int64_t uncachedReads = (int64_t)cacheSaved + stats[7]; //the words that would have been read without the cache
+		vol->lightingCacheSavedBytes = cacheSaved * (float)sizeof(GLuint);
+		vol->lightingCacheSavings = uncachedReads > 0 ? (float)cacheSaved / uncachedReads : 0.0f;
 
-			if(i < vol->numVoxelNodes - 2)
-				memmove(&vol->gpuVoxelLayout[i + 1], &vol->gpuVoxelLayout[i + 2], sizeof(DNvoxelNode) * (vol->numVoxelNodes - i - 2));
-			
-			vol->numVoxelNodes--;
-		}
+		vol->lightingCursorStep = stats[3] == UINT32_MAX ? 0 : stats[3];
+		if(stats[8] > 0)
+			g_wavefrontRayOverflow = true;
+	}
+}
 
-		if(numCopies > maxCopies)
-			break;
+static bool _DN_resize_lighting_request_buffer(size_t numVoxels, size_t numRays)
+{
+	size_t size = LIGHTING_REQUEST_HEADER_SIZE + numVoxels * LIGHTING_WORK_SIZE;
+	if(numRays > 0)
+		size += WAVEFRONT_HEADER_SIZE + numRays * WAVEFRONT_BYTES_PER_RAY;
+
+	char message[256];
+	sprintf(message, "automatically resizing lighting request buffer to accomodate %zi voxels and %zi wavefront rays (%zi bytes)", numVoxels, numRays, size);
+	g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_NOTE, message);
+
+	_DN_clear_gl_errors();
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, g_lightingRequestBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	if(_DN_gl_error())
+	{
+		g_DN_message_callback(DN_MESSAGE_GPU_MEMORY, DN_MESSAGE_ERROR, "failed to resize lighting request buffer");
+		return false;
 	}
-}
\ No newline at end of file
+
+	g_maxLightingVoxels = numVoxels;
+	g_maxWavefrontRays = numRays;
+	return true;
+}
+
+static void _DN_set_lighting_uniforms(DNvolume* vol, GLprogram program, uint32_t frameSeed, int maxDiffuseSamples, DNvec3* sunDir)
+{
+	glUseProgram(program);
+
+	//bind buffers:
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vol->glChunkBufferID);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vol->glMapBufferID);
+	_DN_bind_voxel_pages(vol->voxelPool, program);
+
+	//send sky data:
+	DN_program_uniform_uint(program, "useCubemap", vol->useCubemap);
+	DN_program_uniform_int(program, "skyCubemap", 2);
+	if(vol->useCubemap)
+	{
+		glActiveTexture(GL_TEXTURE0 + 2);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, vol->glCubemapTex);
+	}
+	else
+	{
+		DN_program_uniform_vec3(program, "skyGradientBot", &vol->skyGradientBot);
+		DN_program_uniform_vec3(program, "skyGradientTop", &vol->skyGradientTop);
+	}
+
+	//send lighting and cam data:
+	DN_program_uniform_vec3(program, "camPos", &vol->camPos);
+	DN_program_uniform_uint(program, "frameSeed", frameSeed);
+	DN_program_uniform_uint(program, "maxDiffuseSamples", maxDiffuseSamples);
+	DN_program_uniform_uint(program, "diffuseMode", vol->diffuseMode);
+	DN_program_uniform_float(program, "specularLodDistance", vol->specularLodDistance);
+	DN_program_uniform_vec3(program, "sunDir", sunDir);
+	DN_program_uniform_vec3(program, "sunStrength", &vol->sunStrength);
+	DN_program_uniform_float(program, "shadowSoftness", vol->shadowSoftness);
+	DN_program_uniform_uint(program, "cacheSunVisibility", vol->cacheSunVisibility);
+	DN_program_uniform_uint(program, "sampleLights", vol->sampleEmissiveLights);
+	DN_program_uniform_vec3(program, "ambientStrength", &vol->ambientLightStrength);
+	glUniform3uiv(glGetUniformLocation(program, "mapSize"), 1, (GLuint*)&vol->mapSize);
+	_DN_set_map_origin_uniforms(vol, program);
+
+	//send the level of detail bands, the band each chunk is lit with was chosen by the request shader:
+	GLuint diffuseBounceLimits[DN_MAX_LIGHTING_LODS + 1] = {0};
+	GLuint specularBounceLimits[DN_MAX_LIGHTING_LODS + 1] = {0};
+	GLuint maxSpecularTiers[DN_MAX_LIGHTING_LODS + 1] = {0};
+	for(uint32_t i = 0; i < _DN_num_lighting_lods(vol); i++)
+	{
+		DNlightingLod lod = _DN_get_lighting_lod(vol, i);
+		diffuseBounceLimits[i] = lod.diffuseBounceLimit;
+		specularBounceLimits[i] = lod.specBounceLimit;
+		maxSpecularTiers[i] = lod.specularQuality < DN_NUM_SPECULAR_TIERS ? lod.specularQuality : DN_NUM_SPECULAR_TIERS - 1;
+	}
+
+	glUniform1uiv(glGetUniformLocation(program, "diffuseBounceLimits"), DN_MAX_LIGHTING_LODS + 1, diffuseBounceLimits);
+	glUniform1uiv(glGetUniformLocation(program, "specularBounceLimits"), DN_MAX_LIGHTING_LODS + 1, specularBounceLimits);
+	glUniform1uiv(glGetUniformLocation(program, "maxSpecularTiers"), DN_MAX_LIGHTING_LODS + 1, maxSpecularTiers);
+
+	//send the wavefront queue layout, in uvec4s from the end of the light list:
+	DN_program_uniform_uint(program, "wavefrontOffset", g_maxLightingVoxels * LIGHTING_WORK_SIZE / (sizeof(GLuint) * 4));
+	DN_program_uniform_uint(program, "rayCapacity", g_maxWavefrontRays);
+}
+
+static uint32_t _DN_num_lighting_lods(DNvolume* vol)
+{
+	return (vol->numLightingLods < DN_MAX_LIGHTING_LODS ? vol->numLightingLods : DN_MAX_LIGHTING_LODS) + 1;
+}
+
+static DNlightingLod _DN_get_lighting_lod(DNvolume* vol, uint32_t band)
+{
+	if(band > 0)
+		return vol->lightingLods[band - 1];
+
+	DNlightingLod res;
+	res.distance = 0.0f;
+	res.diffuseBounceLimit = vol->diffuseBounceLimit;
+	res.specBounceLimit = vol->specBounceLimit;
+	res.specularQuality = vol->specularQuality;
+	res.maxSamples = 0;
+	res.updateInterval = 1;
+	return res;
+}
+
+static void _DN_invalidate_shadows(DNvolume* vol, int mapIndex)
+{
+	if(vol->numSunInvalidations < DN_MAX_SUN_INVALIDATIONS)
+		vol->sunInvalidations[vol->numSunInvalidations++] = mapIndex;
+	else //too many to check individually, recompute every chunk's instead
+		DN_invalidate_sun_visibility(vol);
+}
+
+static void _DN_discard_pending_chunks(DNvolume* vol)
+{
+	while(vol->numPendingUploads > 0)
+	{
+		DNchunkJob* job;
+		if(!DN_queue_pop(vol->completedUploads, (void**)&job))
+		{
+			DN_thread_yield();
+			continue;
+		}
+
+		vol->map[job->mapIndex].uploadPending = false;
+		vol->numPendingUploads--;
+		DN_FREE(job);
+	}
+}
+
+static bool _DN_queue_upload(DNvolume* vol, int mapIndex)
+{
+	//resize the upload queue if not large enough:
+	if(vol->numQueuedUploads >= vol->uploadQueueCap)
+	{
+		size_t newCap = fmax(vol->uploadQueueCap * 2, 64);
+
+		char message[256];
+		sprintf(message, "automatically resizing upload queue memory to accomodate %zi requests (%zi bytes)", newCap, newCap * sizeof(DNuploadRequest));
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_NOTE, message);
+
+		if(!DN_set_max_upload_requests(vol, newCap))
+			return false;
+	}
+
+	vol->uploadQueue[vol->numQueuedUploads++] = (DNuploadRequest){mapIndex, vol->syncCount, 0.0f};
+	vol->map[mapIndex].uploadQueued = true;
+	return true;
+}
+
+static float _DN_upload_priority(DNvolume* vol, DNuploadRequest request, DNvec3 camDir, float cosHalfFOV)
+{
+	DNivec3 pos = vol->chunks[vol->map[request.mapIndex].chunkIndex].pos;
+	DNvec3 toChunk = DN_vec3_sub((DNvec3){pos.x + 0.5f, pos.y + 0.5f, pos.z + 0.5f}, vol->camPos);
+	float dist = fmax(DN_vec3_length(toChunk), 1.0f);
+
+	//a chunk's screen coverage falls off with the square of its distance, chunks outside of the view are only seen through bounces:
+	float coverage = 1.0f / (dist * dist);
+	if(DN_vec3_dot(toChunk, camDir) < dist * cosHalfFOV)
+		coverage *= 0.25f;
+
+	//the longer a request waits, the more important it becomes, so that none are starved:
+	return coverage * (1.0f + (vol->syncCount - request.frameQueued) * 0.1f);
+}
+
+static int _DN_compare_upload_requests(const void* a, const void* b)
+{
+	float priorityA = ((const DNuploadRequest*)a)->priority;
+	float priorityB = ((const DNuploadRequest*)b)->priority;
+	return (priorityA < priorityB) - (priorityA > priorityB);
+}
+
+static void _DN_schedule_uploads(DNvolume* vol, DNchunkHandleGPU* gpuMap, const uint32_t* opaqueMaterials, const uint32_t* emissiveMaterials)
+{
+	//remove requests for chunks that were removed or evicted since being queued:
+	size_t numQueued = 0;
+	for(size_t i = 0; i < vol->numQueuedUploads; i++)
+	{
+		int mapIndex = vol->uploadQueue[i].mapIndex;
+		int gpuFlag = gpuMap[mapIndex].flags & 3;
+
+		bool needed = vol->map[mapIndex].flag != 0 && (gpuFlag == 3 || (gpuFlag == 2 && vol->chunks[vol->map[mapIndex].chunkIndex].updated));
+		if(needed)
+			vol->uploadQueue[numQueued++] = vol->uploadQueue[i];
+		else
+			vol->map[mapIndex].uploadQueued = false;
+	}
+	vol->numQueuedUploads = numQueued;
+
+	//only keep enough chunks in flight to cover the next couple of frames, so that priorities stay up to date:
+	size_t maxPending = COMPLETED_UPLOAD_QUEUE_SIZE;
+	if(vol->maxUploadChunks > 0)
+		maxPending = fmin(maxPending, vol->maxUploadChunks * 2);
+
+	if(vol->numQueuedUploads == 0 || vol->numPendingUploads >= maxPending)
+		return;
+
+	size_t numSubmit = fmin(maxPending - vol->numPendingUploads, vol->numQueuedUploads);
+
+	//sort by priority, only needed if not every request can be submitted:
+	if(numSubmit < vol->numQueuedUploads)
+	{
+		DNvec3 camDir = DN_cam_dir(vol->camOrient);
+
+		//camFOV spans the shorter side of the screen, the view cone has to reach the edges of the longer side too:
+		float aspectRatio = vol->camAspectRatio > 0.0f ? vol->camAspectRatio : 1.0f;
+		float halfFOV = atanf(tanf(DN_deg_to_rad(vol->camFOV * 0.5f)) * fmax(aspectRatio, 1.0f / aspectRatio));
+		float cosHalfFOV = cosf(halfFOV);
+
+		for(size_t i = 0; i < vol->numQueuedUploads; i++)
+			vol->uploadQueue[i].priority = _DN_upload_priority(vol, vol->uploadQueue[i], camDir, cosHalfFOV);
+
+		qsort(vol->uploadQueue, vol->numQueuedUploads, sizeof(DNuploadRequest), _DN_compare_upload_requests);
+	}
+
+	//submit the highest priority requests:
+	size_t numSubmitted = 0;
+	while(numSubmitted < numSubmit && _DN_submit_chunk_job(vol, vol->uploadQueue[numSubmitted].mapIndex, opaqueMaterials, emissiveMaterials))
+	{
+		vol->map[vol->uploadQueue[numSubmitted].mapIndex].uploadQueued = false;
+		numSubmitted++;
+	}
+
+	vol->numQueuedUploads -= numSubmitted;
+	memmove(vol->uploadQueue, vol->uploadQueue + numSubmitted, sizeof(DNuploadRequest) * vol->numQueuedUploads);
+}
+
+static void _DN_stream_to_gpu(DNvolume* vol, DNchunkHandle* cpuMap, DNchunkHandleGPU* gpuMap, int mapIndex, int* gpuFlag)
+{
+	//if a chunk was added to the cpu map, add it to the gpu map:
+	if(cpuMap[mapIndex].flag != 0 && *gpuFlag == 0)
+	{
+		gpuMap[mapIndex].flags = 1;
+		*gpuFlag = 1;
+	}
+	else if(cpuMap[mapIndex].flag == 0 && *gpuFlag != 0) //if chunk was removed from the cpu map, remove it from the gpu map
+	{
+		if(*gpuFlag == 2)
+			_DN_invalidate_shadows(vol, mapIndex);
+		_DN_unload_voxels(vol, mapIndex);
+
+		gpuMap[mapIndex].flags = 0;
+		*gpuFlag = 0;
+	}
+
+	if(cpuMap[mapIndex].flag == 0)
+		return;
+
+	//if requested (flag = 3) or updated, queue the chunk to be uploaded. an updated chunk keeps its old data on the gpu until the new data is ready:
+	DNchunk* chunk = &vol->chunks[cpuMap[mapIndex].chunkIndex];
+	if(!cpuMap[mapIndex].uploadPending && !cpuMap[mapIndex].uploadQueued && (*gpuFlag == 3 || (*gpuFlag == 2 && chunk->updated)))
+		_DN_queue_upload(vol, mapIndex);
+
+	//chunks that aren't on the gpu don't need to be refreshed, they are copied again when requested:
+	if(*gpuFlag < 2 && !cpuMap[mapIndex].uploadPending && !cpuMap[mapIndex].uploadQueued)
+		chunk->updated = false;
+}
+
+static void _DN_unload_voxels(DNvolume* vol, int mapIndex)
+{
+	int node = vol->map[mapIndex].voxelNode;
+	if(node < 0)
+		return;
+
+	vol->numVoxelsGpu -= vol->voxelPool->gpuVoxelLayout[node].size;
+	vol->map[mapIndex].voxelNode = -1;
+	_DN_free_voxel_node(vol->voxelPool, node);
+}
+
+static void _DN_release_voxel_nodes(DNvolume* vol)
+{
+	DNvoxelPool* pool = vol->voxelPool;
+	for(size_t i = 0; i < pool->voxelCap / VOXEL_NODE_MIN_SIZE; i++)
+		if(pool->gpuVoxelLayout[i].owner == vol)
+			_DN_unload_voxels(vol, pool->gpuVoxelLayout[i].mapIndex);
+
+	//the eviction candidates may point to the volume's tiles:
+	pool->evictionClock = pool->clock - 1;
+}
+
+static void _DN_set_tile_flags(DNvolume* vol, int mapIndex, GLuint flags)
+{
+	DNvoxelPool* pool = vol->voxelPool;
+	if(pool->syncVolume == vol)
+	{
+		pool->syncMap[mapIndex].flags = flags;
+		return;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, mapIndex * sizeof(DNchunkHandleGPU) + offsetof(DNchunkHandleGPU, flags), sizeof(GLuint), &flags);
+}
+
+static void _DN_set_tile_voxel_index(DNvolume* vol, int mapIndex, GLuint voxelIndex)
+{
+	DNvoxelPool* pool = vol->voxelPool;
+	if(pool->syncVolume == vol)
+	{
+		pool->syncMap[mapIndex].voxelIndex = voxelIndex;
+		return;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glMapBufferID);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, mapIndex * sizeof(DNchunkHandleGPU) + offsetof(DNchunkHandleGPU, voxelIndex), sizeof(GLuint), &voxelIndex);
+}
+
+static uint32_t _DN_voxel_node_age(DNvoxelPool* pool, DNvoxelNode node)
+{
+	if(node.mapIndex < 0)
+		return UINT32_MAX;
+
+	return pool->clock - node.owner->map[node.mapIndex].lastUsedClock;
+}
+
+static void _DN_stream_chunk(DNvolume* vol, int mapIndex, DNchunkGPU chunk)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vol->glChunkBufferID);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, mapIndex * sizeof(DNchunkGPU), sizeof(DNchunkGPU), &chunk);
+}
+
+static bool _DN_stream_voxels(DNvolume* vol, int mapIndex, int numVoxels, DNvoxelGPU* voxels)
+{
+	DNvoxelPool* pool = vol->voxelPool;
+
+	//release any node the tile still holds:
+	_DN_unload_voxels(vol, mapIndex);
+
+	//calculate needed node size:
+	int nodeSize = 16;
+	while(nodeSize < numVoxels)
+		nodeSize *= 2;
+
+	//take the smallest unused node that fits, if there is none the least recently used chunk with a large enough node is overwritten (of any volume in the pool):
+	int index = _DN_alloc_voxel_node(pool, nodeSize);
+	if(index < 0)
+	{
+		//if there isn't an old enough chunk, return true to double the size of the voxel buffer.
+		//a chunk may only be overwritten once every volume in the pool has synced without drawing it:
+		DNevictionCandidate old;
+		if(!_DN_next_eviction_candidate(pool, nodeSize, &old))
+		{
+			_DN_set_tile_flags(vol, mapIndex, 1);
+			return true;
+		}
+
+		_DN_set_tile_flags(old.owner, old.mapIndex, 1);
+		_DN_unload_voxels(old.owner, old.mapIndex);
+		index = _DN_alloc_voxel_node(pool, nodeSize);
+	}
+
+	//send data:
+	pool->gpuVoxelLayout[index].mapIndex = mapIndex;
+	pool->gpuVoxelLayout[index].owner = vol;
+	vol->map[mapIndex].voxelNode = index;
+	vol->map[mapIndex].lastUsedClock = pool->clock;
+	vol->numVoxelsGpu += nodeSize;
+	_DN_set_tile_voxel_index(vol, mapIndex, pool->gpuVoxelLayout[index].startPos);
+	size_t offset;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, _DN_get_voxel_page(pool, pool->gpuVoxelLayout[index].startPos, &offset));
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset * sizeof(DNvoxelGPU), numVoxels * sizeof(DNvoxelGPU), voxels);
+
+	return false;
+}
+
+static int _DN_voxel_node_size_index(uint32_t size)
+{
+	int index = 0;
+	while((VOXEL_NODE_MIN_SIZE << index) < size)
+		index++;
+
+	return index;
+}
+
+static void _DN_push_free_voxel_node(DNvoxelPool* pool, int index)
+{
+	DNvoxelNode* node = &pool->gpuVoxelLayout[index];
+	int sizeIndex = _DN_voxel_node_size_index(node->size);
+
+	node->prevFree = -1;
+	node->nextFree = pool->freeVoxelNodes[sizeIndex];
+	if(node->nextFree >= 0)
+		pool->gpuVoxelLayout[node->nextFree].prevFree = index;
+	pool->freeVoxelNodes[sizeIndex] = index;
+
+	pool->numFreeVoxelNodes[sizeIndex]++;
+	pool->numFreeVoxelsGpu += node->size;
+	_DN_update_voxel_fragmentation(pool);
+}
+
+static void _DN_remove_free_voxel_node(DNvoxelPool* pool, int index)
+{
+	DNvoxelNode* node = &pool->gpuVoxelLayout[index];
+	int sizeIndex = _DN_voxel_node_size_index(node->size);
+
+	if(node->prevFree >= 0)
+		pool->gpuVoxelLayout[node->prevFree].nextFree = node->nextFree;
+	else
+		pool->freeVoxelNodes[sizeIndex] = node->nextFree;
+	if(node->nextFree >= 0)
+		pool->gpuVoxelLayout[node->nextFree].prevFree = node->prevFree;
+
+	pool->numFreeVoxelNodes[sizeIndex]--;
+	pool->numFreeVoxelsGpu -= node->size;
+	_DN_update_voxel_fragmentation(pool);
+}
+
+static bool _DN_has_free_voxel_node(DNvoxelPool* pool, uint32_t size)
+{
+	for(int i = _DN_voxel_node_size_index(size); i < DN_NUM_VOXEL_NODE_SIZES; i++)
+		if(pool->freeVoxelNodes[i] >= 0)
+			return true;
+
+	return false;
+}
+
+static int _DN_alloc_voxel_node(DNvoxelPool* pool, uint32_t size)
+{
+	for(int i = _DN_voxel_node_size_index(size); i < DN_NUM_VOXEL_NODE_SIZES; i++)
+	{
+		int index = pool->freeVoxelNodes[i];
+		if(index < 0)
+			continue;
+
+		_DN_take_voxel_node(pool, index, size);
+		return index;
+	}
+
+	return -1;
+}
+
+static void _DN_take_voxel_node(DNvoxelPool* pool, int index, uint32_t size)
+{
+	_DN_remove_free_voxel_node(pool, index);
+	_DN_split_voxel_node(pool, index, size);
+	_DN_add_voxel_block_usage(pool, pool->gpuVoxelLayout[index].startPos, size);
+	pool->defragStalled = false;
+}
+
+static void _DN_free_voxel_node(DNvoxelPool* pool, int index)
+{
+	pool->gpuVoxelLayout[index].mapIndex = -1;
+	pool->gpuVoxelLayout[index].owner = NULL;
+	_DN_add_voxel_block_usage(pool, pool->gpuVoxelLayout[index].startPos, -(int32_t)pool->gpuVoxelLayout[index].size);
+	pool->defragStalled = false;
+
+	//a node's buddy is the other half of the node it was split from, the entry at its start is always valid since nodes never cross their buddy's boundary:
+	uint32_t size = pool->gpuVoxelLayout[index].size;
+	while(size < DN_CHUNK_LENGTH)
+	{
+		int buddy = index ^ (size / VOXEL_NODE_MIN_SIZE);
+		if(pool->gpuVoxelLayout[buddy].mapIndex >= 0 || pool->gpuVoxelLayout[buddy].size != size)
+			break;
+
+		_DN_remove_free_voxel_node(pool, buddy);
+		index = index < buddy ? index : buddy;
+		size *= 2;
+		pool->gpuVoxelLayout[index].size = size;
+		pool->numVoxelNodes--;
+	}
+
+	_DN_push_free_voxel_node(pool, index);
+}
+
+static void _DN_split_voxel_node(DNvoxelPool* pool, int index, uint32_t size)
+{
+	DNvoxelNode* node = &pool->gpuVoxelLayout[index];
+	while(node->size > size)
+	{
+		node->size /= 2;
+
+		int buddy = index + node->size / VOXEL_NODE_MIN_SIZE;
+		pool->gpuVoxelLayout[buddy].size = node->size;
+		pool->gpuVoxelLayout[buddy].startPos = node->startPos + node->size;
+		pool->gpuVoxelLayout[buddy].mapIndex = -1;
+		pool->gpuVoxelLayout[buddy].owner = NULL;
+		_DN_push_free_voxel_node(pool, buddy);
+		pool->numVoxelNodes++;
+	}
+}
+
+static void _DN_add_voxel_nodes(DNvoxelPool* pool, size_t start, size_t end)
+{
+	//entries that aren't at the start of a node are never read as in-use nodes, so every entry is marked unused:
+	for(size_t i = start / VOXEL_NODE_MIN_SIZE; i < end / VOXEL_NODE_MIN_SIZE; i++)
+	{
+		pool->gpuVoxelLayout[i].mapIndex = -1;
+		pool->gpuVoxelLayout[i].owner = NULL;
+	}
+
+	for(size_t i = start; i < end; i += DN_CHUNK_LENGTH)
+	{
+		DNvoxelNode* node = &pool->gpuVoxelLayout[i / VOXEL_NODE_MIN_SIZE];
+		node->size = DN_CHUNK_LENGTH;
+		node->startPos = i;
+		_DN_push_free_voxel_node(pool, i / VOXEL_NODE_MIN_SIZE);
+		pool->numVoxelNodes++;
+
+		pool->voxelBlocks[i / DN_CHUNK_LENGTH].usage = 0;
+	}
+}
+
+static void _DN_update_voxel_fragmentation(DNvoxelPool* pool)
+{
+	size_t numFreeFull = pool->numFreeVoxelNodes[DN_NUM_VOXEL_NODE_SIZES - 1] * DN_CHUNK_LENGTH;
+	pool->voxelFragmentation = pool->numFreeVoxelsGpu > 0 ? 1.0f - (float)numFreeFull / pool->numFreeVoxelsGpu : 0.0f;
+}
+
+static void _DN_add_voxel_block_usage(DNvoxelPool* pool, size_t pos, int32_t amount)
+{
+	int index = pos / DN_CHUNK_LENGTH;
+	DNvoxelBlock* block = &pool->voxelBlocks[index];
+
+	//unlink from the list of the old usage:
+	if(block->usage > 0 && block->usage < DN_CHUNK_LENGTH)
+	{
+		if(block->prevPartial >= 0)
+			pool->voxelBlocks[block->prevPartial].nextPartial = block->nextPartial;
+		else
+			pool->partialVoxelBlocks[block->usage / VOXEL_NODE_MIN_SIZE] = block->nextPartial;
+		if(block->nextPartial >= 0)
+			pool->voxelBlocks[block->nextPartial].prevPartial = block->prevPartial;
+	}
+
+	block->usage += amount;
+
+	//link into the list of the new usage:
+	if(block->usage > 0 && block->usage < DN_CHUNK_LENGTH)
+	{
+		int usageIndex = block->usage / VOXEL_NODE_MIN_SIZE;
+		block->prevPartial = -1;
+		block->nextPartial = pool->partialVoxelBlocks[usageIndex];
+		if(block->nextPartial >= 0)
+			pool->voxelBlocks[block->nextPartial].prevPartial = index;
+		pool->partialVoxelBlocks[usageIndex] = index;
+	}
+}
+
+static void _DN_defragment_gpu_voxel_buffer(DNvoxelPool* pool, size_t maxBytes)
+{
+	//nodes never cross a DN_CHUNK_LENGTH boundary, so the buffer is treated as blocks of that size. A block only becomes
+	//a full-sized node again once every node in it is unused, so nodes are moved out of the emptiest blocks and into the fullest ones
+
+	if(maxBytes == 0 || pool->voxelFragmentation == 0.0f || pool->defragStalled)
+		return;
+
+	//go through the partially used blocks from emptiest to fullest, moving out of the emptiest frees the most space per byte copied:
+	size_t numBytes = 0;
+	bool moved = false;
+	for(int i = 1; i < DN_NUM_VOXEL_BLOCK_USAGES - 1 && numBytes < maxBytes; i++)
+	{
+		//every block in a list has the same usage, so once a node doesn't fit anywhere no node at least as large from the same list will:
+		uint32_t failedSize = UINT32_MAX;
+
+		int src = pool->partialVoxelBlocks[i];
+		while(src >= 0 && numBytes < maxBytes)
+		{
+			int next = pool->voxelBlocks[src].nextPartial;
+
+			//empty the block for as long as its nodes fit elsewhere, it leaves the list once the first one is moved:
+			while(numBytes < maxBytes && pool->voxelBlocks[src].usage > 0)
+			{
+				int srcNode = _DN_largest_voxel_node(pool, src);
+				uint32_t size = pool->gpuVoxelLayout[srcNode].size;
+				if(size >= failedSize)
+					break;
+
+				int dstNode = _DN_find_defrag_destination(pool, srcNode);
+				if(dstNode < 0)
+				{
+					failedSize = size;
+					break;
+				}
+
+				_DN_move_voxel_node(pool, srcNode, dstNode);
+				numBytes += size * sizeof(DNvoxelGPU);
+				moved = true;
+			}
+
+			//a block that was moved into has a higher usage and left the list, in which case the list is started over:
+			if(next >= 0 && pool->voxelBlocks[next].usage != i * VOXEL_NODE_MIN_SIZE)
+				next = pool->partialVoxelBlocks[i];
+			src = next;
+		}
+	}
+
+	//once nothing can be moved, nothing can until a node is taken or freed:
+	if(!moved)
+		pool->defragStalled = true;
+}
+
+static int _DN_largest_voxel_node(DNvoxelPool* pool, int block)
+{
+	const int nodesPerBlock = DN_CHUNK_LENGTH / VOXEL_NODE_MIN_SIZE;
+	int largest = -1;
+	for(int i = block * nodesPerBlock; i < (block + 1) * nodesPerBlock; i += pool->gpuVoxelLayout[i].size / VOXEL_NODE_MIN_SIZE)
+	{
+		DNvoxelNode node = pool->gpuVoxelLayout[i];
+		if(node.mapIndex < 0)
+			continue;
+
+		if(largest < 0 || node.size > pool->gpuVoxelLayout[largest].size)
+			largest = i;
+	}
+
+	return largest;
+}
+
+static int _DN_find_defrag_destination(DNvoxelPool* pool, int srcNode)
+{
+	uint32_t size = pool->gpuVoxelLayout[srcNode].size;
+	int srcBlock = pool->gpuVoxelLayout[srcNode].startPos / DN_CHUNK_LENGTH;
+	uint32_t srcUsage = pool->voxelBlocks[srcBlock].usage;
+
+	//full-sized unused nodes are in empty blocks, so only the smaller sizes are searched:
+	int dstNode = -1;
+	for(int i = _DN_voxel_node_size_index(size); i < DN_NUM_VOXEL_NODE_SIZES - 1; i++)
+	for(int j = pool->freeVoxelNodes[i]; j >= 0; j = pool->gpuVoxelLayout[j].nextFree)
+	{
+		DNvoxelNode node = pool->gpuVoxelLayout[j];
+		int block = node.startPos / DN_CHUNK_LENGTH;
+		uint32_t usage = pool->voxelBlocks[block].usage;
+		if(block == srcBlock || usage < srcUsage)
+			continue;
+
+		if(dstNode < 0)
+		{
+			dstNode = j;
+			continue;
+		}
+
+		DNvoxelNode best = pool->gpuVoxelLayout[dstNode];
+		uint32_t bestUsage = pool->voxelBlocks[best.startPos / DN_CHUNK_LENGTH].usage;
+		if(usage > bestUsage || (usage == bestUsage && node.size < best.size))
+			dstNode = j;
+	}
+
+	return dstNode;
+}
+
+static void _DN_move_voxel_node(DNvoxelPool* pool, int srcNode, int dstNode)
+{
+	//take the destination and split it down to size:
+	_DN_take_voxel_node(pool, dstNode, pool->gpuVoxelLayout[srcNode].size);
+
+	//move the data with a single copy (the nodes never overlap):
+	DNvoxelNode* from = &pool->gpuVoxelLayout[srcNode];
+	DNvoxelNode* to   = &pool->gpuVoxelLayout[dstNode];
+
+	size_t fromOffset, toOffset;
+	glBindBuffer(GL_COPY_READ_BUFFER, _DN_get_voxel_page(pool, from->startPos, &fromOffset));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _DN_get_voxel_page(pool, to->startPos, &toOffset));
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, fromOffset * sizeof(DNvoxelGPU), toOffset * sizeof(DNvoxelGPU), from->size * sizeof(DNvoxelGPU));
+
+	//only the moved chunk's tile needs to point to its new node:
+	to->mapIndex = from->mapIndex;
+	to->owner = from->owner;
+	to->owner->map[to->mapIndex].voxelNode = dstNode;
+	_DN_set_tile_voxel_index(to->owner, to->mapIndex, to->startPos);
+
+	_DN_free_voxel_node(pool, srcNode);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//VOXEL PAGES:
+
+static bool _DN_resize_voxel_pages(DNvoxelPool* pool, size_t num)
+{
+	size_t pageSize = VOXEL_PAGE_SIZE;
+	size_t numPages = (num + pageSize - 1) / pageSize;
+
+	for(size_t i = 0; i < DN_MAX_VOXEL_PAGES; i++)
+	{
+		size_t oldSize = i < pool->numVoxelPages ? fmin(pool->voxelCap - i * pageSize, pageSize) : 0;
+		size_t newSize = i < numPages ? fmin(num - i * pageSize, pageSize) : 0;
+		if(oldSize == newSize)
+			continue;
+
+		//free pages past the end:
+		if(newSize == 0)
+		{
+			glDeleteBuffers(1, &pool->glVoxelBufferIDs[i]);
+			continue;
+		}
+
+		//create the new page, freeing any pages that were added before failing:
+		GLuint newPage;
+		if(!_DN_gen_shader_storage_buffer(&newPage, newSize * sizeof(DNvoxelGPU)))
+		{
+			for(size_t j = pool->numVoxelPages; j < i; j++)
+				glDeleteBuffers(1, &pool->glVoxelBufferIDs[j]);
+
+			return false;
+		}
+
+		//copy the old page's data and free it:
+		if(oldSize > 0)
+		{
+			glBindBuffer(GL_COPY_READ_BUFFER, pool->glVoxelBufferIDs[i]);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, newPage);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, fmin(oldSize, newSize) * sizeof(DNvoxelGPU));
+			glDeleteBuffers(1, &pool->glVoxelBufferIDs[i]);
+		}
+
+		pool->glVoxelBufferIDs[i] = newPage;
+	}
+
+	pool->numVoxelPages = numPages;
+	return true;
+}
+
+static GLuint _DN_get_voxel_page(DNvoxelPool* pool, size_t pos, size_t* offset)
+{
+	*offset = pos & (VOXEL_PAGE_SIZE - 1);
+	return pool->glVoxelBufferIDs[pos >> g_voxelPageShift];
+}
+
+static void _DN_bind_voxel_pages(DNvoxelPool* pool, GLprogram program)
+{
+	//unused bindings get the first page so that every block the shaders declare is backed by a buffer, they are never read:
+	for(int i = 0; i < DN_MAX_VOXEL_PAGES; i++)
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4 + i, pool->glVoxelBufferIDs[i < pool->numVoxelPages ? i : 0]);
+
+	DN_program_uniform_uint(program, "voxelPageShift", g_voxelPageShift);
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------//
+//VRAM BUDGET:
+
+static size_t _DN_max_voxel_cap(DNvoxelPool* pool)
+{
+	if(pool->vramBudget == 0)
+		return SIZE_MAX;
+
+	//the map and chunk buffers of every volume have a fixed size, the voxel buffer gets whatever is left:
+	size_t fixedBytes = pool->mapVramUsage;
+	size_t maxCap = pool->vramBudget > fixedBytes ? (pool->vramBudget - fixedBytes) / sizeof(DNvoxelGPU) : 0;
+
+	//keep the size a multiple of DN_CHUNK_LENGTH, at least 1 full node is always kept so that chunks can still be drawn:
+	maxCap = maxCap / DN_CHUNK_LENGTH * DN_CHUNK_LENGTH;
+	return maxCap > DN_CHUNK_LENGTH ? maxCap : DN_CHUNK_LENGTH;
+}
+
+static size_t _DN_map_vram_usage(DNvolume* vol)
+{
+	size_t numTiles = vol->mapSize.x * vol->mapSize.y * vol->mapSize.z;
+	return numTiles * (sizeof(DNchunkHandleGPU) + sizeof(DNchunkGPU));
+}
+
+static void _DN_update_vram_usage(DNvolume* vol)
+{
+	DNvoxelPool* pool = vol->voxelPool;
+	vol->vramUsage = _DN_map_vram_usage(vol) + vol->numVoxelsGpu * sizeof(DNvoxelGPU);
+	pool->vramUsage = pool->mapVramUsage + pool->voxelCap * sizeof(DNvoxelGPU);
+}
+
+static void _DN_find_eviction_candidates(DNvoxelPool* pool)
+{
+	pool->evictionClock = pool->clock;
+	memset(pool->evictionStart, 0, sizeof(pool->evictionStart));
+	memset(pool->evictionNext, 0, sizeof(pool->evictionNext));
+
+	DNevictionCandidate* newCandidates = DN_REALLOC(pool->evictionCandidates, sizeof(DNevictionCandidate) * (pool->voxelCap / VOXEL_NODE_MIN_SIZE));
+	if(!newCandidates)
+	{
+		g_DN_message_callback(DN_MESSAGE_CPU_MEMORY, DN_MESSAGE_ERROR, "failed to reallocate memory for eviction candidates");
+		return;
+	}
+	pool->evictionCandidates = newCandidates;
+
+	//a chunk may only be evicted once every volume in the pool has synced without drawing it:
+	size_t numCandidates = 0;
+	for(size_t i = 0; i < pool->voxelCap / VOXEL_NODE_MIN_SIZE; i++)
+	{
+		DNvoxelNode node = pool->gpuVoxelLayout[i];
+		uint32_t age = _DN_voxel_node_age(pool, node);
+		if(node.mapIndex < 0 || age <= pool->numVolumes)
+			continue;
+
+		pool->evictionCandidates[numCandidates++] = (DNevictionCandidate){node.owner, node.mapIndex, age, _DN_voxel_node_size_index(node.size)};
+	}
+
+	qsort(pool->evictionCandidates, numCandidates, sizeof(DNevictionCandidate), _DN_compare_eviction_candidates);
+
+	//find where each node size starts:
+	size_t candidate = 0;
+	for(int i = 0; i <= DN_NUM_VOXEL_NODE_SIZES; i++)
+	{
+		while(candidate < numCandidates && pool->evictionCandidates[candidate].sizeIndex < i)
+			candidate++;
+
+		pool->evictionStart[i] = candidate;
+		if(i < DN_NUM_VOXEL_NODE_SIZES)
+			pool->evictionNext[i] = candidate;
+	}
+}
+
+static int _DN_compare_eviction_candidates(const void* a, const void* b)
+{
+	const DNevictionCandidate* candA = a;
+	const DNevictionCandidate* candB = b;
+
+	if(candA->sizeIndex != candB->sizeIndex)
+		return candA->sizeIndex < candB->sizeIndex ? -1 : 1;
+
+	return candA->age > candB->age ? -1 : candA->age < candB->age ? 1 : 0;
+}
+
+static bool _DN_next_eviction_candidate(DNvoxelPool* pool, uint32_t minSize, DNevictionCandidate* candidate)
+{
+	if(pool->evictionClock != pool->clock)
+		_DN_find_eviction_candidates(pool);
+
+	//the oldest chunk of each large enough node size is at the front of its group, candidates that were evicted, moved to a different node size, or used since are skipped:
+	int best = -1;
+	for(int i = _DN_voxel_node_size_index(minSize); i < DN_NUM_VOXEL_NODE_SIZES; i++)
+	{
+		for(; pool->evictionNext[i] < pool->evictionStart[i + 1]; pool->evictionNext[i]++)
+		{
+			DNevictionCandidate cand = pool->evictionCandidates[pool->evictionNext[i]];
+			int node = cand.owner->map[cand.mapIndex].voxelNode;
+			if(node >= 0 && pool->gpuVoxelLayout[node].size == (VOXEL_NODE_MIN_SIZE << i) && _DN_voxel_node_age(pool, pool->gpuVoxelLayout[node]) > pool->numVolumes)
+				break;
+		}
+
+		if(pool->evictionNext[i] < pool->evictionStart[i + 1] && (best < 0 || pool->evictionCandidates[pool->evictionNext[i]].age > pool->evictionCandidates[pool->evictionNext[best]].age))
+			best = i;
+	}
+
+	if(best < 0)
+		return false;
+
+	*candidate = pool->evictionCandidates[pool->evictionNext[best]++];
+	return true;
+}
+
+static void _DN_evict_lru_chunks(DNvoxelPool* pool, uint32_t nodeSize)
+{
+	//evict the least recently used chunk of any volume until a large enough node is free:
+	DNevictionCandidate lru;
+	while(!_DN_has_free_voxel_node(pool, nodeSize) && _DN_next_eviction_candidate(pool, VOXEL_NODE_MIN_SIZE, &lru))
+	{
+		_DN_set_tile_flags(lru.owner, lru.mapIndex, 1);
+		_DN_unload_voxels(lru.owner, lru.mapIndex);
+	}
+}
+
+static size_t _DN_trim_gpu_voxel_buffer(DNvoxelPool* pool)
+{
+	//track how long the buffer has been mostly empty:
+	size_t numUsed = pool->voxelCap - pool->numFreeVoxelsGpu;
+	if(numUsed < pool->voxelCap / 4)
+		pool->lowUsageFrames++;
+	else
+		pool->lowUsageFrames = 0;
+
+	//find the size the buffer should be, it is halved after sustained low usage and never exceeds the budget:
+	size_t maxCap = _DN_max_voxel_cap(pool);
+	size_t target = pool->voxelCap;
+	if(pool->lowUsageFrames >= VOXEL_SHRINK_FRAMES)
+		target = pool->voxelCap / 2 / DN_CHUNK_LENGTH * DN_CHUNK_LENGTH;
+
+	size_t minCap = pool->minVoxelCap < maxCap ? pool->minVoxelCap : maxCap;
+	if(target > maxCap)
+		target = maxCap;
+	if(target < minCap)
+		target = (minCap + DN_CHUNK_LENGTH - 1) / DN_CHUNK_LENGTH * DN_CHUNK_LENGTH;
+	if(target < DN_CHUNK_LENGTH)
+		target = DN_CHUNK_LENGTH;
+
+	if(target >= pool->voxelCap)
+		return pool->voxelCap;
+
+	//move the chunks stored past the target into free space before it, limited by the defragmentation budget.
+	//moving or evicting a node only merges it with unused nodes, so every in-use node past it stays where it is:
+	size_t numBytes = 0;
+	bool clear = true;
+	for(size_t i = target / VOXEL_NODE_MIN_SIZE; i < pool->voxelCap / VOXEL_NODE_MIN_SIZE; i++)
+	{
+		DNvoxelNode node = pool->gpuVoxelLayout[i];
+		if(node.mapIndex < 0)
+			continue;
+
+		//find the smallest unused node before the target that fits it:
+		int dstNode = -1;
+		for(int j = _DN_voxel_node_size_index(node.size); j < DN_NUM_VOXEL_NODE_SIZES && dstNode < 0; j++)
+		for(int k = pool->freeVoxelNodes[j]; k >= 0; k = pool->gpuVoxelLayout[k].nextFree)
+			if(pool->gpuVoxelLayout[k].startPos < target)
+			{
+				dstNode = k;
+				break;
+			}
+
+		//if there is still room for the chunk it waits until it can be moved, otherwise it is evicted unless a volume has drawn it since its last sync:
+		if(dstNode >= 0 && pool->defragBudget > 0 && numBytes < pool->defragBudget)
+		{
+			_DN_move_voxel_node(pool, i, dstNode);
+			numBytes += node.size * sizeof(DNvoxelGPU);
+		}
+		else if(dstNode < 0 && _DN_voxel_node_age(pool, node) > pool->numVolumes)
+		{
+			_DN_set_tile_flags(node.owner, node.mapIndex, 1);
+			_DN_unload_voxels(node.owner, node.mapIndex);
+		}
+		else
+			clear = false;
+	}
+
+	return clear ? target : pool->voxelCap;
+}
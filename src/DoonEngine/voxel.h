@@ -8,6 +8,7 @@ extern "C"
 
 #include "globals.h"
 #include "QuickMath/quickmath.h"
+#include "utility/thread.h"
 #include <GLAD/glad.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -24,9 +25,35 @@ extern "C"
 //the material that represents an empty voxel
 #define DN_MATERIAL_EMPTY 255
 
+//the number of frames that DN_update_lighting()'s timer queries can be in flight for, results are read this many frames late at most
+#define DN_LIGHTING_TIMER_FRAMES 4
+
+//the number of sizes that a GPU voxel node can have, from 16 DNvoxels up to DN_CHUNK_LENGTH, doubling each time
+#define DN_NUM_VOXEL_NODE_SIZES 6
+
+//the number of usages a block of the GPU voxel buffer can have, from 0 DNvoxels up to DN_CHUNK_LENGTH in steps of the smallest node size (16)
+#define DN_NUM_VOXEL_BLOCK_USAGES (DN_CHUNK_LENGTH / 16 + 1)
+
+//the maximum number of pages (separate GPU buffers) that a volume's voxel data can be split across, each page holds up to 2^24 DNvoxels
+//or as many as GL_MAX_SHADER_STORAGE_BLOCK_SIZE allows, whichever is smaller
+#define DN_MAX_VOXEL_PAGES 4
+
+//the number of specular quality tiers that the lighting shader has sample sets for (must match voxelLighting.comp)
+#define DN_NUM_SPECULAR_TIERS 5
+
+//the maximum number of lighting level of detail bands that a volume can have (must match voxelLighting.comp and voxelLightingRequests.comp)
+#define DN_MAX_LIGHTING_LODS 4
+
+//the number of changed chunks whose shadows DN_update_lighting() can recompute individually (must match voxelLightingRequests.comp), beyond that every chunk's sun visibility is recomputed
+#define DN_MAX_SUN_INVALIDATIONS 16
+
 //the value used for gamma correction, raise albedo values to this value to convert them to linear color space
 #define DN_GAMMA 2.2f
 
+//define DN_COMPACT_VOXELS when building the engine to store GPU voxels in 12 bytes instead of 16, normals drop from 11 to 8 bits per axis
+//and specular light from RGB9E5 to a square-rooted RGB565 (run the demo with --test-voxel-precision to see the error of each layout)
+//#define DN_COMPACT_VOXELS
+
 //flattens a 3D vector position into a 1D array index given the dimensions of the array
 #define DN_FLATTEN_INDEX(p, s) (p.x) + (s.x) * ((p.y) + (p.z) * (s.y))
 
@@ -68,16 +95,86 @@ typedef struct DNchunkHandle
 {
 	uint8_t flag;        //0 = does not exist, 1 = loaded on CPU, in the future, may be used for streaming from disk
 	uint32_t chunkIndex; //the index at which the chunk's data can be found, invalid if flag = 0
+	int32_t voxelNode;   //the index into the voxel pool's gpuVoxelLayout of the node holding this tile's voxels, or -1 if it has none
+	bool uploadPending;  //whether the chunk is currently being prepared for upload by a worker thread
+	bool uploadQueued;   //whether the chunk is waiting in the volume's uploadQueue
+	uint32_t lastUsedClock; //the voxel pool's clock when the chunk was last drawn or uploaded, used to find the least recently used chunks across every volume in the pool
 } DNchunkHandle;
 
 //represents a group of voxels on the GPU
 typedef struct DNvoxelNode
 {
-	uint32_t size;     //the node's size, in DNvoxels
-	size_t startPos;   //the node's start position, in DNvoxels
-	DNivec3 chunkPos;  //the position of the chunk that owns the node, if invalid, the node is unused
+	uint32_t size;          //the node's size, in DNvoxels
+	size_t startPos;        //the node's start position, in DNvoxels
+	int32_t mapIndex;       //the index of the map tile that owns the node, or -1 if the node is unused
+	struct DNvolume* owner; //the volume whose map tile owns the node, or NULL if the node is unused
+	int32_t prevFree;       //the previous unused node of the same size, or -1. only valid if the node is unused
+	int32_t nextFree;       //the next unused node of the same size, or -1. only valid if the node is unused
 } DNvoxelNode;
 
+//a DN_CHUNK_LENGTH-sized block of the GPU voxel buffer, nodes never cross a block's boundary
+typedef struct DNvoxelBlock
+{
+	uint32_t usage;      //the number of DNvoxels in the block used by chunks
+	int32_t prevPartial; //the previous partially used block with the same usage, or -1. only valid if the block is partially used
+	int32_t nextPartial; //the next partially used block with the same usage, or -1. only valid if the block is partially used
+} DNvoxelBlock;
+
+//GPU voxel memory that one or more volumes store their chunks' voxels in
+typedef struct DNvoxelPool
+{
+	GLuint glVoxelBufferIDs[DN_MAX_VOXEL_PAGES]; //READ ONLY | The openGL buffer IDs for each page of the voxel buffer on the GPU, only the first numVoxelPages are valid
+
+	size_t voxelCap;             //READ ONLY | The current number of DNvoxels that are stored GPU-side by this pool
+	size_t numVoxelNodes;        //READ ONLY | The current number of nodes that the GPU voxel data is broken up into
+	size_t numVoxelPages;        //READ ONLY | The current number of pages that the GPU voxel data is split across. Every page but the last is full
+	size_t numFreeVoxelsGpu;     //READ ONLY | The number of DNvoxels in the voxel buffer that are not used by any chunk
+	float voxelFragmentation;    //READ ONLY | The fraction of free GPU voxels that are not part of a full-sized (DN_CHUNK_LENGTH) node, in the range [0.0, 1.0]
+	size_t defragBudget;         //READ-WRITE | The maximum number of bytes that DN_sync_gpu() will copy each frame to defragment the voxel buffer, 0 disables defragmentation, in which case the voxel buffer only shrinks once every chunk past its new size was evicted
+	size_t vramBudget;           //READ-WRITE | The maximum number of bytes the voxel buffer and the map and chunk buffers of every volume in the pool may use together, 0 for no limit. Once reached, the least recently used chunks of any volume are evicted instead of growing the voxel buffer
+	size_t vramUsage;            //READ ONLY | The number of bytes currently used by the voxel buffer and the map and chunk buffers of every volume in the pool
+	size_t mapVramUsage;         //READ ONLY | The number of bytes used by the map and chunk buffers of every volume in the pool
+	size_t minVoxelCap;          //READ-WRITE | The voxel buffer is never automatically shrunk below this many DNvoxels
+	uint32_t lowUsageFrames;     //READ ONLY | The number of consecutive calls to DN_sync_gpu() that less than a quarter of the voxel buffer was used for. The voxel buffer is halved once this gets large enough
+
+	size_t numVolumes;           //READ ONLY | The number of volumes storing their voxels in this pool
+	size_t chunkCap;             //READ ONLY | The sum of every volume's chunkCap, the voxel buffer never grows past this many full chunks
+	uint32_t clock;              //READ ONLY | Incremented by every call to DN_sync_gpu() on a volume in the pool, compared against each chunk's lastUsedClock to evict the least recently used chunks
+	struct DNvolume* syncVolume; //READ ONLY | The volume currently inside of DN_sync_gpu(), whose map buffer is mapped to syncMap, or NULL
+	struct DNchunkHandleGPU* syncMap; //READ ONLY | The mapped map buffer of syncVolume
+
+	DNvoxelNode* gpuVoxelLayout; //READ ONLY | An array representing the voxel layout on the GPU. Each node is stored at its startPos / 16, so its index never changes. Only the entries at the start of a node are valid
+	int32_t freeVoxelNodes[DN_NUM_VOXEL_NODE_SIZES];   //READ ONLY | The index of the first unused node of each size (16, 32, ... DN_CHUNK_LENGTH DNvoxels), or -1 if there are none. The rest are linked through nextFree
+	size_t numFreeVoxelNodes[DN_NUM_VOXEL_NODE_SIZES]; //READ ONLY | The number of unused nodes of each size
+	DNvoxelBlock* voxelBlocks;                         //READ ONLY | The usage of each DN_CHUNK_LENGTH-sized block of the voxel buffer, kept up to date as nodes are taken and freed
+	int32_t partialVoxelBlocks[DN_NUM_VOXEL_BLOCK_USAGES]; //READ ONLY | The first partially used block of each usage (0, 16, ... DN_CHUNK_LENGTH DNvoxels), or -1. The first and last entries are always -1. The rest are linked through nextPartial
+	bool defragStalled;                                //READ ONLY | Whether the last defragmentation pass found no node that could be moved, the defragmenter is idle until a node is taken or freed
+
+	struct DNevictionCandidate* evictionCandidates;    //READ ONLY | The chunks of every volume in the pool that can be evicted, grouped by node size and sorted from least to most recently used. Built the first time a chunk doesn't fit during a call to DN_sync_gpu()
+	size_t evictionStart[DN_NUM_VOXEL_NODE_SIZES + 1]; //READ ONLY | The index of the first candidate of each node size in evictionCandidates, the last entry is the number of candidates
+	size_t evictionNext[DN_NUM_VOXEL_NODE_SIZES];      //READ ONLY | The index of the next candidate of each node size to evict
+	uint32_t evictionClock;                            //READ ONLY | The clock that evictionCandidates was built at, it is rebuilt once the clock changes
+} DNvoxelPool;
+
+//a chunk waiting to be uploaded to the GPU
+typedef struct DNuploadRequest
+{
+	uint32_t mapIndex;    //the index of the map tile to upload
+	uint32_t frameQueued; //the volume's syncCount when the request was queued, used to determine its age
+	float priority;       //the request's priority as of the last DN_sync_gpu(), higher priorities are uploaded first
+} DNuploadRequest;
+
+//the lighting quality of chunks from a distance from the camera onwards
+typedef struct DNlightingLod
+{
+	float distance;              //the distance from the camera, in DNchunks, that the band starts at. Chunks use the furthest band that starts at or before their center
+	uint32_t diffuseBounceLimit; //the maximum number of bounces for diffuse rays, replaces the volume's diffuseBounceLimit
+	uint32_t specBounceLimit;    //the maximum number of bounces for specular rays, replaces the volume's specBounceLimit
+	uint32_t specularQuality;    //the highest specular quality tier, replaces the volume's specularQuality
+	uint32_t maxSamples;         //the maximum number of diffuse samples a chunk takes in one frame, 0 for no limit
+	uint32_t updateInterval;     //the minimum number of frames between a chunk's lighting updates, newly uploaded chunks are always lit. 0 or 1 for no limit
+} DNlightingLod;
+
 //material properties for a voxel
 typedef struct DNmaterial
 {
@@ -99,28 +196,40 @@ typedef struct DNvolume
 	//opengl handles:
 	GLuint glMapBufferID;            //READ ONLY | The openGL buffer ID for the map buffer on the GPU
 	GLuint glChunkBufferID;          //READ ONLY | The openGL buffer ID for the chunk buffer on the GPU
-	GLuint glVoxelBufferID;          //READ ONLY | The openGL buffer ID for the voxel buffer on the GPU
+	GLuint glLightingTimerIDs[DN_LIGHTING_TIMER_FRAMES]; //READ ONLY | The openGL query IDs used to time DN_update_lighting(), one for each frame in flight
+	GLuint glLightingStatsBufferID;  //READ ONLY | The openGL buffer ID for the lighting statistics (samples taken, tiles reached) of each timed frame
 
 	//data parameters:
 	DNuvec3 mapSize;                 //READ ONLY | The size, in DNchunks, of the map
+	DNivec3 mapOrigin;               //READ ONLY | The position, in DNchunks, of the map's minimum corner. The map covers [mapOrigin, mapOrigin + mapSize - 1], every position is stored at its position modulo mapSize. Set with DN_set_map_origin()
 	size_t chunkCap;                 //READ ONLY | The current number of DNchunks that are stored CPU-side by this map. The length of chunks
 	size_t nextChunk;                //READ ONLY | The next known empty chunk index. Used to speed up adding new chunks
-	size_t voxelCap;                 //READ ONLY | The current number of DNvoxels that are stored GPU-side by this map
-	size_t numVoxelNodes;            //READ ONLY | The current number of nodes that the GPU voxel data is broken up into
-	size_t numLightingRequests;      //READ ONLY | The number of chunks queued to have their lighting updated
-	size_t lightingRequestCap;       //READ ONLY | The maximum number of chunks that can be stored in lightingRequests
+	size_t numPendingUploads;        //READ ONLY | The number of chunks currently being prepared for upload by worker threads
+	size_t numQueuedUploads;         //READ ONLY | The number of chunks waiting in uploadQueue
+	size_t uploadQueueCap;           //READ ONLY | The maximum number of chunks that can be stored in uploadQueue
+	size_t maxUploadChunks;          //READ-WRITE | The maximum number of chunks that DN_sync_gpu() will upload each frame, 0 for no limit
+	size_t maxUploadBytes;           //READ-WRITE | The number of bytes after which DN_sync_gpu() stops uploading chunks for the frame, 0 for no limit
+	size_t numVoxelsGpu;             //READ ONLY | The number of DNvoxels in voxelPool that are used by this volume's chunks
+	size_t vramUsage;                //READ ONLY | The number of bytes used by this volume's map and chunk buffers and its chunks in voxelPool
+	DNvoxelPool* voxelPool;          //READ ONLY | The pool that this volume stores its GPU voxels in, may be shared with other volumes
+	bool ownsVoxelPool;              //READ ONLY | Whether voxelPool was created with the volume and will be deleted with it
 
 	//data:
 	DNchunkHandle* map;              //READ-WRITE | The map of chunks. An array with length = mapSize.x * mapSize.y * mapSize.z
 	DNchunk* chunks;                 //READ-WRITE | The array of chunks that the volume has
 	DNmaterial* materials;           //READ-WRITE | The array of materials that the volume has
-	GLuint* lightingRequests;        //READ-WRITE | An array of chunk indices (represented as a uvec4 due to a need for aligment on the gpu, only the x component is used), signifies which chunks will have their lighting updated when DN_update_lighting() is called
-	DNvoxelNode* gpuVoxelLayout;     //READ ONLY  | An array representing the voxel layout on the GPU
+	DNqueue* completedUploads;       //READ ONLY  | The queue that worker threads push chunks to once they are ready to be uploaded, emptied by DN_sync_gpu()
+	DNuploadRequest* uploadQueue;    //READ ONLY  | The chunks that were requested by the GPU or updated, but have not been sent to a worker thread yet. Kept between frames
+
+	//sliding window callbacks:
+	void (*loadChunkCallback)(struct DNvolume* vol, DNivec3 pos);   //READ-WRITE | Called by DN_set_map_origin() for every map position that moves into the map, used to generate or load its chunk. NULL leaves new positions empty
+	void (*unloadChunkCallback)(struct DNvolume* vol, DNivec3 pos); //READ-WRITE | Called by DN_set_map_origin() for every existing chunk right before it moves out of the map and is removed, used to save it. NULL discards it
 
 	//camera parameters:
 	DNvec3 camPos;                   //READ-WRITE | The camera's position relative to this map, in DNchunks
 	DNvec3 camOrient;                //READ-WRITE | The camera's orientation, in degrees. Expressed as {pitch, yaw, roll}
 	float camFOV;                    //READ-WRITE | The camera's field of view, measured in degrees
+	float camAspectRatio;            //READ ONLY  | The aspect ratio (height / width) of the texture drawn to by the last call to DN_draw(), used to find which chunks are in view when prioritizing uploads
 	uint32_t camViewMode;            //READ-WRITE | The camera's view mode, 0 = full lighting; 1 = albedo only; 2 = diffuse light only; 3 = specular light only; 4 = per-voxel normals; 5 = per-face normals
 
 	//lighting parameters:
@@ -129,7 +238,24 @@ typedef struct DNvolume
 	DNvec3 ambientLightStrength;     //READ-WRITE | The minimum lighting for every voxel
 	uint32_t diffuseBounceLimit;     //READ-WRITE | The maximum number of bounces for diffuse rays, can greatly affect performance
 	uint32_t specBounceLimit;        //READ-WRITE | The maximum number of bounces for specular rays, can greatly affect performance
+	uint32_t specularQuality;        //READ-WRITE | The highest specular quality tier, in the range [0, DN_NUM_SPECULAR_TIERS - 1]. Tiers 0-4 trace 1, 4, 8, 15, and 32 rays per voxel. Shiny materials and far away voxels use lower tiers automatically
+	float specularLodDistance;       //READ-WRITE | The distance from the camera, in DNchunks, after which the specular quality drops one tier every time the distance doubles. 0 disables
+	uint32_t diffuseMode;            //READ-WRITE | How diffuse rays are traced, 0 = path traced, bouncing up to diffuseBounceLimit times; 1 = radiance cached, each ray ends at the first voxel it hits and uses that voxel's stored diffuse lighting, giving infinite bounces for the cost of one ray
 	float shadowSoftness;            //READ-WRITE | How soft shadows from direct light appear
+	bool sampleEmissiveLights;       //READ-WRITE | Whether emissive voxels are sampled directly with a shadow ray every diffuse sample, instead of only lighting voxels whose diffuse rays happen to hit them. Up to 128 chunks with emissive voxels are sampled, chosen by brightness and distance. Off by default
+	bool cacheSunVisibility;         //READ-WRITE | Whether each voxel's view of the sun is cached, so that only voxels near the edges of shadows cast shadow rays every sample. Recomputed when sunDir changes or nearby chunks are edited, so it gives nothing while the sun moves every frame. Off by default
+	bool wavefrontLighting;          //READ-WRITE | Whether lighting is traced by the wavefront pipeline instead of the single lighting shader. It passes rays between separate generate, trace, and shade passes through queues, so every GPU thread does the same kind of work. Compare lightingRaysPerMs to see which is faster on a given GPU and scene
+
+	//adaptive sampling parameters:
+	float lightingNoiseTarget;       //READ-WRITE | The estimated error in a chunk's diffuse lighting (in luminance) below which it is considered converged. Chunks above it are relit every frame with more samples, converged ones are only refreshed occasionally. 0, the default, disables adaptive sampling
+	uint32_t maxChunkSamples;        //READ-WRITE | The maximum number of diffuse samples that a noisy chunk can take in one frame
+	uint32_t convergedRefreshRate;   //READ-WRITE | Converged chunks are only relit once every convergedRefreshRate of their lighting split frames
+	uint32_t lightingSampleBudget;   //READ-WRITE | The maximum number of diffuse samples, summed over every voxel, that DN_update_lighting() takes each frame, 0 for no limit. Newly uploaded chunks are always lit
+	float lightingTimeBudget;        //READ-WRITE | The GPU time, in milliseconds, that DN_update_lighting() aims to take each frame. Replaces lightingSplit: every visible chunk is a candidate every frame, and the budget is handed out round-robin starting from lightingCursor. 0 disables
+
+	//lighting level of detail parameters:
+	uint32_t numLightingLods;        //READ-WRITE | The number of bands in lightingLods that are used, in the range [0, DN_MAX_LIGHTING_LODS]. 0 lights every chunk the same
+	DNlightingLod lightingLods[DN_MAX_LIGHTING_LODS]; //READ-WRITE | Cheaper lighting for far away chunks, in order of increasing distance. Chunks closer than the first band use the volume's own lighting parameters
 
 	//sky parameters:
 	bool useCubemap;                 //READ-WRITE | Whether or not the volume should sample a cubemap for the sky color, otherwise a gradient will be used
@@ -138,7 +264,26 @@ typedef struct DNvolume
 	DNvec3 skyGradientTop;           //READ-WRITE | If the volume does NOT sample a cubemap, the color at the top of the gradient for the sky color
 
 	uint32_t frameNum;               //READ ONLY  | Used to split the lighting calculations over multiple frames, determines the current frame. In the range [0, lightingSplit - 1]
-	float lastTime;                  //READ ONLY  | Used to ensure that each group of chunks receives the same time value, even when they are calculated at different times
+	uint32_t lightingSplit;          //READ ONLY  | The lightingSplit passed to the last call to DN_sync_gpu()
+	float lastTime;                  //READ ONLY  | The time passed to the last call to DN_update_lighting(), used to seed the lighting shader's random number generator
+	uint32_t syncCount;              //READ ONLY  | The number of times DN_sync_gpu() has been called, used to determine how long chunks have been waiting to be uploaded
+
+	float lightingTime;              //READ ONLY  | The GPU time, in milliseconds, that DN_update_lighting() took a few frames ago, measured with timer queries
+	float lightingSamplesPerMs;      //READ ONLY  | The estimated number of diffuse samples (of a single voxel) the GPU takes each millisecond, used to turn lightingTimeBudget into a number of samples. 0 until measured
+	float lightingRaysPerMs;         //READ ONLY  | The estimated number of rays (counting each bounce) that DN_update_lighting() traces each millisecond. 0 until measured
+	float lightingOccupancy;         //READ ONLY  | The fraction of the lighting shader's threads that lit a voxel in the last measured frame. Voxels are packed into a single work list, so only the last work group has idle threads
+	float lightingChunkOccupancy;    //READ ONLY  | What lightingOccupancy would have been if every chunk's voxels were lit by work groups of their own, for comparison
+	float lightingCacheSavedBytes;   //READ ONLY  | The bytes of map and chunk data that the lighting shader's rays read from its work groups' shared memory instead of GPU buffers in the last measured frame, minus the bytes it took to fill it. Each work group caches the 27 chunks around its first voxel. Only measured if DN_LIGHTING_STATS is defined when building the engine, 0 otherwise or with wavefrontLighting
+	float lightingCacheSavings;      //READ ONLY  | The fraction of the map and chunk data reads that the lighting shader's rays would otherwise have made which the shared memory cache saved, see lightingCacheSavedBytes
+	uint32_t lightingCursor;         //READ ONLY  | The map index that the lighting budget is handed out from first, moved forward every frame so that every visible chunk gets its turn
+	uint32_t lightingCursorStep;     //READ ONLY  | How far lightingCursor moves each frame, the number of map tiles the budget reached in the last measured frame. 0 if it reached every tile
+	uint32_t lightingTimerFrame;     //READ ONLY  | The number of frames that have been timed, the next one uses glLightingTimerIDs[lightingTimerFrame % DN_LIGHTING_TIMER_FRAMES]
+	uint32_t lightingTimersPending;  //READ ONLY  | A bit for every timer query whose result hasn't been read yet
+
+	uint32_t sunEpoch;               //READ ONLY  | Incremented whenever every chunk's cached sun visibility must be recomputed
+	DNvec3 sunEpochDir;              //READ ONLY  | The sunDir that the current sunEpoch was computed with
+	uint32_t numSunInvalidations;    //READ ONLY  | The number of chunks in sunInvalidations
+	GLuint sunInvalidations[DN_MAX_SUN_INVALIDATIONS]; //READ ONLY | The map indices of chunks uploaded or removed since the last call to DN_update_lighting(), the chunks in their shadow recompute their sun visibility
 } DNvolume;
 
 //represents memory operations
@@ -152,9 +297,9 @@ typedef enum DNmemOp
 //--------------------------------------------------------------------------------------------------------------------------------//
 //INITIALIZATION:
 
-//Initializes the entire voxel rendering pipeline. Call this before any other functions. @returns true on success, or false on failure
+//Initializes the entire voxel rendering pipeline, including the worker threads used to prepare chunks for upload. Call this before any other functions. @returns true on success, or false on failure
 bool DN_init();
-//Completely cleans up and deinitializes the voxel pipeline
+//Completely cleans up and deinitializes the voxel pipeline, stopping the worker threads. Call this after every volume has been deleted
 void DN_quit();
 
 /*Creates a new DNvolume with the specified parameters 
@@ -164,11 +309,28 @@ void DN_quit();
  * @returns the new map or NULL if the volume creation failed in any way
  */
 DNvolume* DN_create_volume(DNuvec3 mapSize, unsigned int minChunks);
+/*Creates a new DNvolume that stores its GPU voxels in an existing pool, shared with every other volume in the pool
+ * @param mapSize the size, in DNchunks, of the map
+ * @param minChunks the number of chunks that will initially be allocated CPU-side
+ * @param pool the pool to store the volume's GPU voxels in, must not be deleted before the volume
+ * @returns the new map or NULL if the volume creation failed in any way
+ */
+DNvolume* DN_create_volume_in_pool(DNuvec3 mapSize, unsigned int minChunks, DNvoxelPool* pool);
 /* Deletes a DNvolume, should be called whenever a map is no longer needed to avoid memory leaks
- * @param vol the volume to delete
+ * @param vol the volume to delete. Its chunks are removed from its voxel pool, which is deleted as well if it was created with the volume
  */
 void DN_delete_volume(DNvolume* vol);
 
+/* Creates a new pool of GPU voxel memory that several volumes can share. Chunks of volumes that are not being drawn get evicted first when the pool runs out of space
+ * @param minChunks determines the number of chunks that the pool will initially have room for
+ * @returns the new pool, or NULL on failure
+ */
+DNvoxelPool* DN_create_voxel_pool(unsigned int minChunks);
+/* Deletes a DNvoxelPool
+ * @param pool the pool to delete, every volume in it must be deleted first
+ */
+void DN_delete_voxel_pool(DNvoxelPool* pool);
+
 /* Loads a DNvolume from a file
  * @param filePath the path to the file to load from
  * @param textureSize the size, in pixels, of the texture that is rendered to
@@ -176,6 +338,13 @@ void DN_delete_volume(DNvolume* vol);
  * @returns the loaded map or NULL, on failure
  */
 DNvolume* DN_load_volume(const char* filePath, unsigned int minChunks);
+/* Loads a DNvolume from a file, storing its GPU voxels in an existing pool
+ * @param filePath the path to the file to load from
+ * @param minChunks the number of chunks that will initially be allocated CPU-side
+ * @param pool the pool to store the volume's GPU voxels in, must not be deleted before the volume
+ * @returns the loaded map or NULL, on failure
+ */
+DNvolume* DN_load_volume_in_pool(const char* filePath, unsigned int minChunks, DNvoxelPool* pool);
 /* Saves a DNvolume to a file
  * @param filePath the path of the file to save to
  * @param vol the volume to save
@@ -206,14 +375,27 @@ void DN_set_view_projection_matrices(DNvolume* vol, float aspectRatio, float nea
  */
 void DN_draw(DNvolume* vol, GLuint outputTexture, DNmat4 view, DNmat4 projection, int rasterColorTexture, int rasterDepthTexture);
 
-/* Updates the lighting on every chunk currently in a map's lightingRequests
+/* Updates the lighting on every visible chunk in the current lighting split, along with every chunk uploaded since it was last lit.
+ * The list of chunks to update is built on the GPU from the visibility flags set by DN_draw(), so nothing is read back to the CPU
+ * If the volume's lightingNoiseTarget is nonzero, visible chunks whose lighting is still noisy are instead updated every frame with up to maxChunkSamples samples,
+ * and converged chunks are only refreshed once every convergedRefreshRate lighting splits, so lightingSplit then only paces converged chunks. Every frame takes at most lightingSampleBudget samples
+ * If the volume's lightingTimeBudget is nonzero, the lighting split is ignored and the samples are instead limited to what the GPU was measured to take in that much time,
+ * handed out round-robin so that every visible chunk gets its turn
+ * If the volume's wavefrontLighting is true, the lighting is traced by the wavefront pipeline instead. Voxels whose rays don't fit in its ray queues are skipped
+ * for the frame, and the queues grow to fit them afterwards
  * @param vol the volume to update
- * @param numDiffuseSamples the number of diffuse lighting samples to take
+ * @param numDiffuseSamples the number of diffuse lighting samples to take for new chunks and chunks that aren't sampled adaptively
  * @param maxDiffuseSamples the maximum number of diffuse samples that a chunk can store at once. The lower the value, the faster lighting can change but the more flickering that can occur. 1000 is a good base value
  * @param time the current running time of the application, used for random seeding
  */
 void DN_update_lighting(DNvolume* vol, int numDiffuseSamples, int maxDiffuseSamples, float time);
 
+/* Makes every chunk recompute its cached sun visibility the next time it is lit. Changes to sunDir and to chunks are detected automatically,
+ * but this must be called after changing a material's opacity, as that changes which voxels cast shadows
+ * @param vol the volume to invalidate the sun visibility of
+ */
+void DN_invalidate_sun_visibility(DNvolume* vol);
+
 //--------------------------------------------------------------------------------------------------------------------------------//
 //MEMORY:
 
@@ -231,11 +413,20 @@ void DN_remove_chunk(DNvolume* vol, DNivec3 pos);
 
 /* Updates the gpu-side data for a map, this should be called every frame (or every few frames)
  * @param vol the volume to sync
- * @param op the operation to perform on the volume. DN_READ will only query the gpu for visible chunks. DN_WRITE will upload voxel data to the GPU if updated or requested. DN_READ_WRITE will do both
+ * @param op the operation to perform on the volume. DN_READ will only track which chunks the gpu has used. DN_WRITE will upload voxel data to the GPU if updated or requested. DN_READ_WRITE will do both
+ * NOTE: chunks are prepared for upload on worker threads, so an updated or requested chunk may only be uploaded by a later call. Updated chunks keep their old data on the GPU until then.
+ * Chunks are uploaded closest, most visible, and longest-waiting first, limited by maxUploadChunks and maxUploadBytes
+ * The voxel pool grows when full and shrinks after a long period of low usage, never growing past its vramBudget. Chunks that don't fit once it shrinks are only evicted after every volume in the pool synced without drawing them, until then the shrink is deferred
  * @param lightingSplit the number of frames to split the lighting calculation over. For example, if this is set to 5 only 1/5 of the chunks will have their lighting updated each frame, increasing performace
  */
 void DN_sync_gpu(DNvolume* vol, DNmemOp op, int lightingSplit);
 
+/* Prepares every chunk of a volume for upload the same way DN_sync_gpu() does, without uploading anything. Used to benchmark chunk packing
+ * @param vol the volume whose chunks to pack
+ * @returns the number of voxels that were packed, after hidden voxels are culled
+ */
+size_t DN_pack_chunks(DNvolume* vol);
+
 //--------------------------------------------------------------------------------------------------------------------------------//
 //MAP SETTINGS:
 
@@ -245,6 +436,12 @@ void DN_sync_gpu(DNvolume* vol, DNmemOp op, int lightingSplit);
  * @returns true on success, false on failure
  */
 bool DN_set_map_size(DNvolume* vol, DNuvec3 size);
+/* Moves a map's window, for worlds larger than the map. Only the chunks that move out of the map are removed, the rest keep their data on both the CPU and GPU
+ * @param vol the volume to change
+ * @param origin the new position, in DNchunks, of the map's minimum corner. Usually kept centered on the camera
+ * NOTE: unloadChunkCallback is called for every chunk that leaves the map and loadChunkCallback for every position that enters it
+ */
+void DN_set_map_origin(DNvolume* vol, DNivec3 origin);
 
 /* Sets a map's maximum number of chunks. It should never be necessary to call as it is called automatically
  * @param vol the volume to change
@@ -253,18 +450,18 @@ bool DN_set_map_size(DNvolume* vol, DNuvec3 size);
  */
 bool DN_set_max_chunks(DNvolume* vol, size_t num);
 /* Set's a map's maximum bumber of voxels in VRAM. It should never be necessary to call as it is called automatically
- * @param vol the volume to change
- * @param num the new maximum number of chunks
+ * @param vol the volume to change, the size of its entire voxel pool is changed
+ * @param num the new maximum number of voxels, rounded up to a multiple of DN_CHUNK_LENGTH. When shrinking, chunks of any volume in the pool stored past the new end are unloaded
  * @returns true on success, false on failure
  */
 bool DN_set_max_voxels_gpu(DNvolume* vol, size_t num);
 
-/* Sets the current maximum number of lighting updates the volume can request at once. It should never be necessary to call as it is called automatically
+/* Sets the current maximum number of chunks that can wait in the volume's upload queue. It should never be necessary to call as it is called automatically
  * @param vol the volume to change
- * @param num the new maximum number of lighting requests
+ * @param num the new maximum number of upload requests
  * @returns true on success, false on failure
  */
-bool DN_set_max_lighting_requests(DNvolume* vol, size_t num);
+bool DN_set_max_upload_requests(DNvolume* vol, size_t num);
 
 //--------------------------------------------------------------------------------------------------------------------------------//
 //MAP UTILITY:
@@ -272,9 +469,15 @@ bool DN_set_max_lighting_requests(DNvolume* vol, size_t num);
 /* Determines whether or not a given map position is inside the map bounds
  * @param vol the volume to check
  * @param pos the position within the map to check, measured in DNchunks
- * @returns true if pos is in the range [0, map->mapSize - 1], false if not
+ * @returns true if pos is in the range [map->mapOrigin, map->mapOrigin + map->mapSize - 1], false if not
  */
 bool DN_in_map_bounds(DNvolume* vol, DNivec3 pos);
+/* Gets the index into a volume's map of a map position. NOTE: does NOT do any bounds checking
+ * @param vol the volume to get the index from
+ * @param pos the position within the map, measured in DNchunks
+ * @returns the index of pos in map, pos is wrapped around the map's size
+ */
+int DN_get_map_index(DNvolume* vol, DNivec3 pos);
 /* Determines whether or not a given chunk position is inside the chunk bounds
  * @param pos the position within a chunk to check, measured in DNvoxels
  * @returns true if pos is in the range [0, DN_CHUNK_SIZE - 1], false if not
@@ -348,8 +551,8 @@ bool DN_step_map(DNvolume* vol, DNvec3 rayDir, DNvec3 rayPos, int maxSteps, DNiv
 
 /* Separates a voxel's position into a map and a chunk position
  * @param pos the position to separate, measured in DNvoxels
- * @param volPos populated with the voxel's chunk's position within the map, equivalent to pos / DN_CHUNK_SIZE
- * @param chunkPos populated with the voxel's position within the chunk, equivalent to pos % DN_CHUNK_SIZE
+ * @param volPos populated with the voxel's chunk's position within the map, equivalent to floor(pos / DN_CHUNK_SIZE)
+ * @param chunkPos populated with the voxel's position within the chunk, always in the range [0, DN_CHUNK_SIZE - 1]
  */
 void DN_separate_position(DNivec3 pos, DNivec3* mapPos, DNivec3* chunkPos);
 
@@ -169,12 +169,12 @@ static void _DN_shape(DNvolume* vol, DNvoxel voxel, VoxelTransformFunc func, voi
 	DN_separate_position(iMax, &mapMax, &chunkMax);
 
 	//bounds check:
-	mapMin.x = QM_MAX(mapMin.x, 0);
-	mapMin.y = QM_MAX(mapMin.y, 0);
-	mapMin.z = QM_MAX(mapMin.z, 0);
-	mapMax.x = QM_MIN(mapMax.x, vol->mapSize.x - 1);
-	mapMax.y = QM_MIN(mapMax.y, vol->mapSize.y - 1);
-	mapMax.z = QM_MIN(mapMax.z, vol->mapSize.z - 1);
+	mapMin.x = QM_MAX(mapMin.x, vol->mapOrigin.x);
+	mapMin.y = QM_MAX(mapMin.y, vol->mapOrigin.y);
+	mapMin.z = QM_MAX(mapMin.z, vol->mapOrigin.z);
+	mapMax.x = QM_MIN(mapMax.x, vol->mapOrigin.x + (int)vol->mapSize.x - 1);
+	mapMax.y = QM_MIN(mapMax.y, vol->mapOrigin.y + (int)vol->mapSize.y - 1);
+	mapMax.z = QM_MIN(mapMax.z, vol->mapOrigin.z + (int)vol->mapSize.z - 1);
 
 	//loop over every chunk:
 	for(int mZ = mapMin.z; mZ <= mapMax.z; mZ++)
@@ -182,7 +182,7 @@ static void _DN_shape(DNvolume* vol, DNvoxel voxel, VoxelTransformFunc func, voi
 	for(int mX = mapMin.x; mX <= mapMax.x; mX++)
 	{
 		DNivec3 mapPos = {mX, mY, mZ};
-		DNchunkHandle mapTile = vol->map[DN_FLATTEN_INDEX(mapPos, vol->mapSize)];
+		DNchunkHandle mapTile = vol->map[DN_get_map_index(vol, mapPos)];
 
 		//loop over every voxel in chunk:
 		for(int cZ = 0; cZ < DN_CHUNK_SIZE; cZ++)
@@ -265,12 +265,12 @@ void DN_shape_sphere(DNvolume* vol, DNvoxel voxel, bool flipNormals, DNvec3 c, f
 	DN_separate_position(iMax, &mapMax, &chunkMax);
 
 	//bounds check:
-	mapMin.x = QM_MAX(mapMin.x, 0);
-	mapMin.y = QM_MAX(mapMin.y, 0);
-	mapMin.z = QM_MAX(mapMin.z, 0);
-	mapMax.x = QM_MIN(mapMax.x, vol->mapSize.x - 1);
-	mapMax.y = QM_MIN(mapMax.y, vol->mapSize.y - 1);
-	mapMax.z = QM_MIN(mapMax.z, vol->mapSize.z - 1);
+	mapMin.x = QM_MAX(mapMin.x, vol->mapOrigin.x);
+	mapMin.y = QM_MAX(mapMin.y, vol->mapOrigin.y);
+	mapMin.z = QM_MAX(mapMin.z, vol->mapOrigin.z);
+	mapMax.x = QM_MIN(mapMax.x, vol->mapOrigin.x + (int)vol->mapSize.x - 1);
+	mapMax.y = QM_MIN(mapMax.y, vol->mapOrigin.y + (int)vol->mapSize.y - 1);
+	mapMax.z = QM_MIN(mapMax.z, vol->mapOrigin.z + (int)vol->mapSize.z - 1);
 
 	const float r2 = r * r;
 	const float r12 = (r + 1.0f) * (r + 1.0f);
@@ -281,7 +281,7 @@ void DN_shape_sphere(DNvolume* vol, DNvoxel voxel, bool flipNormals, DNvec3 c, f
 	for(int mX = mapMin.x; mX <= mapMax.x; mX++)
 	{
 		DNivec3 mapPos = {mX, mY, mZ};
-		DNchunkHandle mapTile = vol->map[DN_FLATTEN_INDEX(mapPos, vol->mapSize)];
+		DNchunkHandle mapTile = vol->map[DN_get_map_index(vol, mapPos)];
 
 		//loop over every voxel in chunk:
 		for(int cZ = 0; cZ < DN_CHUNK_SIZE; cZ++)
@@ -642,12 +642,10 @@ void DN_place_model_into_volume(DNvolume* vol, DNvoxelModel model, DNivec3 pos)
 			continue;
 
 		DNivec3 worldPos = {pos.x + x, pos.y + y, pos.z + z};
-		DNivec3 chunkPos = {worldPos.x / DN_CHUNK_SIZE, worldPos.y / DN_CHUNK_SIZE, worldPos.z / DN_CHUNK_SIZE};
+		DNivec3 chunkPos, localPos;
+		DN_separate_position(worldPos, &chunkPos, &localPos);
 
 		if(DN_in_map_bounds(vol, chunkPos))
-		{
-			DNivec3 localPos = {worldPos.x % DN_CHUNK_SIZE, worldPos.y % DN_CHUNK_SIZE, worldPos.z % DN_CHUNK_SIZE};
 			DN_set_compressed_voxel(vol, chunkPos, localPos, model.voxels[iModel]);
-		}
 	}
 }
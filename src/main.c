@@ -9,6 +9,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <GLAD/glad.h>
 #include <GLFW/glfw3.h>
@@ -36,6 +37,21 @@ void GLAPIENTRY message_callback(GLenum source, GLenum type, GLuint id, GLenum s
 //Prints any DN message to the console
 void DN_message_callback(DNmessageType type, DNmessageSeverity severity, const char* message);
 
+//Times DN_sync_gpu() on a volume with 100k resident chunks while voxels are edited every frame, run with --benchmark-streaming
+void benchmark_streaming();
+//Times preparing the chunks of a terrain volume for upload, run with --benchmark-packing
+void benchmark_packing();
+//Measures the precision that the GPU voxel layouts (16 bytes, or 12 with DN_COMPACT_VOXELS) keep of normals and lighting, run with --test-voxel-precision
+void test_voxel_precision();
+
+//copies of the GPU voxel encodings in voxel.c and voxelShared.comp, used by test_voxel_precision():
+uint32_t encode_octahedral(uint32_t normal, int bits);
+DNvec3 decode_octahedral(uint32_t val, int bits);
+uint32_t encode_rgb9e5(DNvec3 color, float offset);
+DNvec3 decode_rgb9e5(uint32_t val);
+uint32_t encode_sqrt_rgb565(DNvec3 color);
+DNvec3 decode_sqrt_rgb565(uint32_t val);
+
 //--------------------------------------------------------------------------------------------------------------------------------//
 
 //maps:
@@ -46,6 +62,9 @@ DNvolume* treeVol;
 DNvolume* sphereVol;
 DNvolume* cerealVol;
 
+//every volume stores its GPU voxels in the same pool, so the volumes that aren't active give up their VRAM to the active one:
+DNvoxelPool* volumePool;
+
 //rasterization textures:
 GLuint rasterColorTex;
 GLuint rasterDepthTex;
@@ -122,7 +141,7 @@ void place_cereal_bowl(DNvolume* vol, DNvoxel bowlVox, DNvec3 pos, float radius,
 	}
 }
 
-int main()
+int main(int argc, char** argv)
 {
 	srand(1234);
 
@@ -373,17 +392,43 @@ int main()
 		return -1;
 	}
 
+	if(argc > 1 && strcmp(argv[1], "--benchmark-streaming") == 0)
+	{
+		benchmark_streaming();
+		DN_quit();
+		glfwTerminate();
+		return 0;
+	}
+
+	if(argc > 1 && strcmp(argv[1], "--benchmark-packing") == 0)
+	{
+		benchmark_packing();
+		DN_quit();
+		glfwTerminate();
+		return 0;
+	}
+
+	if(argc > 1 && strcmp(argv[1], "--test-voxel-precision") == 0)
+	{
+		test_voxel_precision();
+		DN_quit();
+		glfwTerminate();
+		return 0;
+	}
+
 	//load volumes from disk:
 	//---------------------------------
-	demoVol   = DN_load_volume("volumes/demo.voxvol"  ,  128);
-	sphereVol = DN_load_volume("volumes/sphere.voxvol",  2048);
+	volumePool = DN_create_voxel_pool(2048);
+
+	demoVol   = DN_load_volume_in_pool("volumes/demo.voxvol"  ,  128, volumePool);
+	sphereVol = DN_load_volume_in_pool("volumes/sphere.voxvol",  2048, volumePool);
 
 	demoVol->glCubemapTex = cubemapTex;
 	demoVol->useCubemap = true;
 
 	//create volume with shapes:
 	//---------------------------------
-	cerealVol = DN_create_volume((DNuvec3){20, 20, 20}, 512);
+	cerealVol = DN_create_volume_in_pool((DNuvec3){20, 20, 20}, 512, volumePool);
 	DNvoxel vox;
 	cerealVol->sunDir = (DNvec3){-0.5f, 1.0f, -0.5f};
 	cerealVol->glCubemapTex = cubemapTex;
@@ -426,7 +471,7 @@ int main()
 
 	//load volume from MagicaVoxel model:
 	//---------------------------------
-	treeVol   = DN_create_volume((DNuvec3){5, 5, 5}, 64);
+	treeVol   = DN_create_volume_in_pool((DNuvec3){5, 5, 5}, 64, volumePool);
 
 	DNvoxelModel model;
 	DN_load_vox_file("models/tree.vox", 0, &model);
@@ -438,6 +483,14 @@ int main()
 	treeVol->materials[0].specular = 0.0f;
 	treeVol->materials[0].opacity = 1.0f;
 
+	//the suns in the demo never move, so every volume can cache which voxels see them. emissive voxels are sampled directly so that small lights don't flicker:
+	DNvolume* volumes[4] = {demoVol, sphereVol, cerealVol, treeVol};
+	for(int i = 0; i < 4; i++)
+	{
+		volumes[i]->cacheSunVisibility = true;
+		volumes[i]->sampleEmissiveLights = true;
+	}
+
 	//main loop:
 	//---------------------------------
 	activeVol = demoVol;
@@ -459,6 +512,9 @@ int main()
 		if(cumTime >= 1.0f)
 		{
 			printf("AVG. FPS: %f\n", 1 / (cumTime / numFrames));
+			printf("LIGHTING: %s, %u lod bands, %f ms, %f rays/ms, %.1f%% occupancy (%.1f%% with per-chunk work groups), chunk cache saved %.2f MB (%.1f%%)\n", activeVol->wavefrontLighting ? "wavefront" : "megakernel", activeVol->numLightingLods,
+				activeVol->lightingTime, activeVol->lightingRaysPerMs, activeVol->lightingOccupancy * 100.0f, activeVol->lightingChunkOccupancy * 100.0f,
+				activeVol->lightingCacheSavedBytes / 1000000.0f, activeVol->lightingCacheSavings * 100.0f);
 			numFrames = 0;
 			cumTime = 0.0f;
 		}
@@ -526,6 +582,8 @@ int main()
 	DN_delete_volume(treeVol);
 	DN_delete_volume(demoVol);
 	DN_delete_volume(sphereVol);
+	DN_delete_volume(cerealVol);
+	DN_delete_voxel_pool(volumePool);
 	DN_quit();
 
 	glDeleteFramebuffers(1, &rasterFBO);
@@ -539,6 +597,278 @@ int main()
 
 	return 0;
 }
+void benchmark_streaming()
+{
+	//a single layer of chunks seen from above, each with 1-64 voxels so that nodes of several sizes are used:
+	DNuvec3 mapSize = {320, 1, 320};
+	size_t numChunks = mapSize.x * mapSize.y * mapSize.z;
+	DNvolume* vol = DN_create_volume(mapSize, 1024);
+	if(!vol)
+		return;
+
+	vol->camPos = (DNvec3){mapSize.x * 0.5f, mapSize.x * 0.6f, mapSize.z * 0.5f};
+	vol->camOrient = (DNvec3){89.0f, 0.0f, 0.0f};
+	vol->maxUploadChunks = 0;
+	vol->maxUploadBytes = 0;
+
+	DNvoxel vox = {0, {0.0f, 1.0f, 0.0f}, {200, 200, 200}};
+	for(int z = 0; z < mapSize.z; z++)
+	for(int x = 0; x < mapSize.x; x++)
+	{
+		int numVoxels = rand() % 64 + 1;
+		for(int i = 0; i < numVoxels; i++)
+			DN_set_voxel(vol, (DNivec3){x, 0, z}, (DNivec3){i % DN_CHUNK_SIZE, 0, i / DN_CHUNK_SIZE}, vox);
+	}
+
+	DNmat4 view, projection;
+	DN_set_view_projection_matrices(vol, (float)SCREEN_H / SCREEN_W, 0.1f, 1000.0f, &view, &projection);
+
+	//upload every chunk, chunks are only uploaded once they are drawn:
+	double startTime = glfwGetTime();
+	size_t numResident = 0;
+	int numLoadFrames = 0;
+	while(numResident < numChunks && numLoadFrames < 10000)
+	{
+		DN_draw(vol, finalTex, view, projection, -1, -1);
+		DN_sync_gpu(vol, DN_READ_WRITE, 1);
+		numLoadFrames++;
+
+		numResident = 0;
+		for(size_t i = 0; i < numChunks; i++)
+			if(vol->map[i].voxelNode >= 0)
+				numResident++;
+	}
+	glFinish();
+	double loadTime = glfwGetTime() - startTime;
+
+	//edit random voxels, every edited chunk is reuploaded and moves to a new node when its size changes:
+	const int numEditFrames = 200;
+	const int editsPerFrame = 64;
+	double syncTime = 0.0;
+	for(int f = 0; f < numEditFrames; f++)
+	{
+		for(int i = 0; i < editsPerFrame; i++)
+		{
+			DNivec3 mapPos = {rand() % mapSize.x, 0, rand() % mapSize.z};
+			DNivec3 chunkPos = {rand() % DN_CHUNK_SIZE, 0, rand() % DN_CHUNK_SIZE};
+			DNchunk* chunk = &vol->chunks[vol->map[DN_get_map_index(vol, mapPos)].chunkIndex];
+
+			if(!DN_does_voxel_exist(vol, mapPos, chunkPos))
+				DN_set_voxel(vol, mapPos, chunkPos, vox);
+			else if(chunk->numVoxels > 1)
+				DN_remove_voxel(vol, mapPos, chunkPos);
+		}
+
+		DN_draw(vol, finalTex, view, projection, -1, -1);
+		glFinish();
+
+		double syncStart = glfwGetTime();
+		DN_sync_gpu(vol, DN_READ_WRITE, 1);
+		glFinish();
+		syncTime += glfwGetTime() - syncStart;
+	}
+
+	printf("STREAMING BENCHMARK: %zu/%zu chunks resident after %d frames (%.2f s), %zu voxel nodes\n", numResident, numChunks, numLoadFrames, loadTime, vol->voxelPool->numVoxelNodes);
+	printf("STREAMING BENCHMARK: %d edits per frame, %.3f ms per DN_sync_gpu() over %d frames\n", editsPerFrame, syncTime * 1000.0 / numEditFrames, numEditFrames);
+
+	DN_delete_volume(vol);
+}
+
+void benchmark_packing()
+{
+	//rolling terrain, so that most voxels are hidden below the surface and some chunks are only partially filled:
+	DNuvec3 mapSize = {16, 4, 16};
+	DNvolume* vol = DN_create_volume(mapSize, mapSize.x * mapSize.y * mapSize.z);
+	if(!vol)
+		return;
+
+	vol->materials[0].emissive = false;
+	vol->materials[0].specular = 0.0f;
+	vol->materials[0].opacity  = 1.0f;
+
+	DNvoxel vox = {0, {0.0f, 1.0f, 0.0f}, {0, 0, 0}};
+	for(int z = 0; z < mapSize.z * DN_CHUNK_SIZE; z++)
+	for(int x = 0; x < mapSize.x * DN_CHUNK_SIZE; x++)
+	{
+		int height = 12 + 6.0f * sinf(x * 0.1f) + 6.0f * cosf(z * 0.13f) + rand() % 3;
+		for(int y = 0; y < height; y++)
+		{
+			vox.albedo = (DNcolor){rand() % 256, rand() % 256, rand() % 256};
+			DNivec3 mapPos, chunkPos;
+			DN_separate_position((DNivec3){x, y, z}, &mapPos, &chunkPos);
+			DN_set_voxel(vol, mapPos, chunkPos, vox);
+		}
+	}
+
+	size_t numChunks = 0;
+	size_t numVoxels = 0;
+	for(size_t i = 0; i < mapSize.x * mapSize.y * mapSize.z; i++)
+	{
+		if(vol->map[i].flag == 0)
+			continue;
+
+		numChunks++;
+		numVoxels += vol->chunks[vol->map[i].chunkIndex].numVoxels;
+	}
+
+	//pack every chunk several times, the first pass is not timed:
+	const int numPasses = 200;
+	size_t numPacked = DN_pack_chunks(vol);
+	double startTime = glfwGetTime();
+	for(int i = 0; i < numPasses; i++)
+		DN_pack_chunks(vol);
+	double packTime = glfwGetTime() - startTime;
+
+	printf("PACKING BENCHMARK: %zu chunks, %zu voxels, %zu exposed voxels packed per pass\n", numChunks, numVoxels, numPacked);
+	printf("PACKING BENCHMARK: %.0f chunks/s, %.2f ms per pass over %d passes\n", numChunks * numPasses / packTime, packTime * 1000.0 / numPasses, numPasses);
+
+	DN_delete_volume(vol);
+}
+
+void test_voxel_precision()
+{
+	//normals, every normal a DNcompressedVoxel can hold:
+	const int octahedralBits[2] = {11, 8};
+	for(int layout = 0; layout < 2; layout++)
+	{
+		double sumError = 0.0;
+		double maxError = 0.0;
+		size_t numNormals = 0;
+		for(uint32_t normal = 0; normal < (1u << 24); normal++)
+		{
+			DNvec3 original = {(int)((normal >> 16) & 0xFF) * 2 - 255, (int)((normal >> 8) & 0xFF) * 2 - 255, (int)(normal & 0xFF) * 2 - 255};
+			original = DN_vec3_normalize(original);
+
+			DNvec3 decoded = decode_octahedral(encode_octahedral(normal, octahedralBits[layout]), octahedralBits[layout]);
+			double error = acos(fmin(fmax((double)original.x * decoded.x + (double)original.y * decoded.y + (double)original.z * decoded.z, -1.0), 1.0)) * 180.0 / 3.14159265358979;
+			sumError += error;
+			maxError = fmax(maxError, error);
+			numNormals++;
+		}
+
+		printf("VOXEL PRECISION: normals, %d-byte voxels (%d-bit octahedral): mean error %.3f degrees, max %.3f degrees\n", layout == 0 ? 16 : 12, octahedralBits[layout], sumError / numNormals, maxError);
+	}
+
+	//lighting, errors are measured after gamma correction (in 1/255ths of the displayed color) with colors spread evenly in display space:
+	const int numColors = 1000000;
+	double sumSpec[2] = {0.0, 0.0}, maxSpec[2] = {0.0, 0.0};
+	double sumDiffuse = 0.0, maxDiffuse = 0.0;
+	srand(1);
+	for(int i = 0; i < numColors; i++)
+	{
+		DNvec3 display = {(float)rand() / RAND_MAX, (float)rand() / RAND_MAX, (float)rand() / RAND_MAX};
+		DNvec3 color = {powf(display.x, DN_GAMMA), powf(display.y, DN_GAMMA), powf(display.z, DN_GAMMA)};
+
+		DNvec3 decoded[2] = {decode_rgb9e5(encode_rgb9e5(color, 0.5f)), decode_sqrt_rgb565(encode_sqrt_rgb565(color))};
+		for(int j = 0; j < 2; j++)
+		{
+			for(int c = 0; c < 3; c++)
+			{
+				double error = fabs(powf(decoded[j].v[c], 1.0f / DN_GAMMA) - display.v[c]) * 255.0;
+				sumSpec[j] += error;
+				maxSpec[j] = fmax(maxSpec[j], error);
+			}
+		}
+	}
+
+	//diffuse light is averaged over many frames, stochastic rounding means that the stored average is unbiased even though every write rounds:
+	for(int i = 0; i < numColors; i++)
+	{
+		DNvec3 display = {(float)rand() / RAND_MAX, (float)rand() / RAND_MAX, (float)rand() / RAND_MAX};
+		DNvec3 color = {powf(display.x, DN_GAMMA), powf(display.y, DN_GAMMA), powf(display.z, DN_GAMMA)};
+
+		DNvec3 decoded = decode_rgb9e5(encode_rgb9e5(color, (float)rand() / ((float)RAND_MAX + 1.0f)));
+		for(int c = 0; c < 3; c++)
+		{
+			double error = fabs(powf(decoded.v[c], 1.0f / DN_GAMMA) - display.v[c]) * 255.0;
+			sumDiffuse += error;
+			maxDiffuse = fmax(maxDiffuse, error);
+		}
+	}
+
+	printf("VOXEL PRECISION: specular, 16-byte voxels (RGB9E5): mean error %.3f/255, max %.3f/255\n", sumSpec[0] / (numColors * 3), maxSpec[0]);
+	printf("VOXEL PRECISION: specular, 12-byte voxels (square root RGB565): mean error %.3f/255, max %.3f/255\n", sumSpec[1] / (numColors * 3), maxSpec[1]);
+	printf("VOXEL PRECISION: diffuse, both layouts (RGB9E5, one stochastically rounded write): mean error %.3f/255, max %.3f/255\n", sumDiffuse / (numColors * 3), maxDiffuse);
+}
+
+uint32_t encode_octahedral(uint32_t normal, int bits)
+{
+	float x = (int)((normal >> 16) & 0xFF) * 2 - 255;
+	float y = (int)((normal >>  8) & 0xFF) * 2 - 255;
+	float z = (int)( normal        & 0xFF) * 2 - 255;
+	uint32_t maxCoord = (1u << bits) - 1;
+
+	float sum = fabsf(x) + fabsf(y) + fabsf(z);
+	if(sum == 0.0f)
+		return ((maxCoord / 2 + 1) << (32 - bits)) | ((maxCoord / 2 + 1) << (32 - 2 * bits));
+
+	x /= sum;
+	y /= sum;
+	if(z < 0.0f)
+	{
+		float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	uint32_t octX = (uint32_t)((x * 0.5f + 0.5f) * maxCoord + 0.5f);
+	uint32_t octY = (uint32_t)((y * 0.5f + 0.5f) * maxCoord + 0.5f);
+	return (octX << (32 - bits)) | (octY << (32 - 2 * bits));
+}
+
+DNvec3 decode_octahedral(uint32_t val, int bits)
+{
+	uint32_t maxCoord = (1u << bits) - 1;
+	DNvec3 normal;
+	normal.x = (val >> (32 - bits)) * (2.0f / maxCoord) - 1.0f;
+	normal.y = ((val >> (32 - 2 * bits)) & maxCoord) * (2.0f / maxCoord) - 1.0f;
+	normal.z = 1.0f - fabsf(normal.x) - fabsf(normal.y);
+
+	float fold = fmaxf(-normal.z, 0.0f);
+	normal.x += normal.x >= 0.0f ? -fold : fold;
+	normal.y += normal.y >= 0.0f ? -fold : fold;
+	return DN_vec3_normalize(normal);
+}
+
+uint32_t encode_rgb9e5(DNvec3 color, float offset)
+{
+	float maxChannel = fmaxf(color.x, fmaxf(color.y, color.z));
+
+	int exponent = (int)floorf(log2f(fmaxf(maxChannel, 1e-30f))) + 16;
+	exponent = exponent < 0 ? 0 : (exponent > 31 ? 31 : exponent);
+	float scale = exp2f(exponent - 24.0f);
+	if(maxChannel / scale + offset >= 512.0f && exponent < 31)
+	{
+		exponent++;
+		scale *= 2.0f;
+	}
+
+	uint32_t r = fminf(color.x / scale + offset, 511.0f);
+	uint32_t g = fminf(color.y / scale + offset, 511.0f);
+	uint32_t b = fminf(color.z / scale + offset, 511.0f);
+	return r | g << 9 | b << 18 | (uint32_t)exponent << 27;
+}
+
+DNvec3 decode_rgb9e5(uint32_t val)
+{
+	float scale = exp2f((float)(val >> 27) - 24.0f);
+	return (DNvec3){(val & 0x1FF) * scale, ((val >> 9) & 0x1FF) * scale, ((val >> 18) & 0x1FF) * scale};
+}
+
+uint32_t encode_sqrt_rgb565(DNvec3 color)
+{
+	uint32_t r = sqrtf(fminf(fmaxf(color.x, 0.0f), 1.0f)) * 31.0f + 0.5f;
+	uint32_t g = sqrtf(fminf(fmaxf(color.y, 0.0f), 1.0f)) * 63.0f + 0.5f;
+	uint32_t b = sqrtf(fminf(fmaxf(color.z, 0.0f), 1.0f)) * 31.0f + 0.5f;
+	return r << 11 | g << 5 | b;
+}
+
+DNvec3 decode_sqrt_rgb565(uint32_t val)
+{
+	DNvec3 root = {((val >> 11) & 0x1F) / 31.0f, ((val >> 5) & 0x3F) / 63.0f, (val & 0x1F) / 31.0f};
+	return (DNvec3){root.x * root.x, root.y * root.y, root.z * root.z};
+}
 
 void glfw_error_callback(int error, const char* msg)
 {
@@ -641,6 +971,26 @@ void process_input(GLFWwindow *window)
 	if(glfwGetKey(window, GLFW_KEY_6) == GLFW_PRESS)
 		activeVol->camViewMode = 5;
 
+	if(glfwGetKey(window, GLFW_KEY_7) == GLFW_PRESS)
+		activeVol->diffuseMode = 0;
+	if(glfwGetKey(window, GLFW_KEY_8) == GLFW_PRESS)
+		activeVol->diffuseMode = 1;
+
+	if(glfwGetKey(window, GLFW_KEY_9) == GLFW_PRESS)
+		activeVol->wavefrontLighting = false;
+	if(glfwGetKey(window, GLFW_KEY_0) == GLFW_PRESS)
+		activeVol->wavefrontLighting = true;
+
+	if(glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
+		activeVol->numLightingLods = 0;
+	if(glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS)
+	{
+		//two example bands, chunks further than 8 and 16 DNchunks from the camera get fewer bounces and samples and are lit less often:
+		activeVol->lightingLods[0] = (DNlightingLod){ 8.0f, 2, 2, 1, 2, 2};
+		activeVol->lightingLods[1] = (DNlightingLod){16.0f, 1, 1, 0, 1, 4};
+		activeVol->numLightingLods = 2;
+	}
+
 	if(glfwGetKey(window, GLFW_KEY_F1) == GLFW_PRESS)
 		activeVol = demoVol;
 	if(glfwGetKey(window, GLFW_KEY_F2) == GLFW_PRESS)